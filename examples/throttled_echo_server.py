@@ -0,0 +1,65 @@
+"""
+An echo server built on BufferEvents, with every client sharing one
+bandwidth-limited rate limit group.  Throttling happens inside libevent;
+Python only runs when there is data to echo.  The group's refill timer only
+runs while clients are connected, so it never keeps dispatch() alive on its
+own.
+"""
+
+import sys
+import socket
+import signal
+import libevent
+
+class EchoConnection(object):
+    def __init__(self, sock, addr, server):
+        self.sock = sock
+        self.addr = addr
+        self.server = server
+        self.sock.setblocking(False)
+        self.bev = libevent.createBufferEvent(
+            self.sock, self._doRead, errorCallback=self._doError)
+        self.bev.setRateLimitGroup(server.group)
+
+    def _doRead(self, bev):
+        bev.write(bev.read())
+
+    def _doError(self, bev, what):
+        self.server.lostClient(self)
+        self.sock.close()
+
+class ThrottledEchoServer(object):
+    def __init__(self, addr="127.0.0.1", port=50505, bytesPerSecond=64*1024):
+        self.group = libevent.createRateLimitGroup(
+            "echo", readRate=bytesPerSecond, writeRate=bytesPerSecond)
+        self.clients = dict()
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setblocking(False)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind((addr, port))
+        self.sock.listen(5)
+        events = libevent.EV_READ|libevent.EV_PERSIST
+        libevent.createEvent(self.sock, events, self._accept).addToLoop()
+
+    def _accept(self, fd, events, eventObj):
+        sock, addr = self.sock.accept()
+        print "Got connection from %s:%s" % addr
+        self.clients[addr] = EchoConnection(sock, addr, self)
+
+    def lostClient(self, client):
+        print "Lost connection from %s:%s" % client.addr
+        print "Group throttled %d bytes written over %.2f seconds" % (
+            self.group.writeThrottledBytes, self.group.writeThrottledTime)
+        del self.clients[client.addr]
+
+def handleSigInt(signum, events, obj):
+    libevent.loopExit(0)
+    raise KeyboardInterrupt
+
+def main():
+    libevent.createSignalHandler(signal.SIGINT, handleSigInt).addToLoop()
+    echosrv = ThrottledEchoServer()
+    libevent.dispatch()
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -20,3 +20,27 @@ def loopExit(seconds):
   
 def dispatch():
   return DefaultEventBase.dispatch()
+
+def createResolver(initialize=True):
+  return DefaultEventBase.createResolver(initialize)
+
+def createBufferEvent(fd, readCallback=None, writeCallback=None, 
+                      errorCallback=None):
+  return DefaultEventBase.createBufferEvent(fd, readCallback, writeCallback,
+                                            errorCallback)
+
+def createRateLimitGroup(name, readRate=0, readBurst=0, writeRate=0, 
+                         writeBurst=0, tick=1.0):
+  return DefaultEventBase.createRateLimitGroup(name, readRate, readBurst,
+                                               writeRate, writeBurst, tick)
+
+def removeRateLimitGroup(name):
+  return DefaultEventBase.removeRateLimitGroup(name)
+
+def setErrorHandler(handler=None, interval=1.0, batchLimit=100, 
+                    stopOnError=False):
+  return DefaultEventBase.setErrorHandler(handler, interval, batchLimit,
+                                          stopOnError)
+
+def flushErrors():
+  return DefaultEventBase.flushErrors()
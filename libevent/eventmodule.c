@@ -7,11 +7,20 @@
 
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <event.h>
+#include <evdns.h>
 #include <Python.h>
 #include <structmember.h>
+#include <frameobject.h>
 
 #define DEFAULT_NUM_PRIORITIES 3
+#define DEFAULT_ERROR_INTERVAL 1.0
+#define DEFAULT_ERROR_BATCH_LIMIT 100
+#define DEFAULT_RESOLVER_MAX_ENTRIES 10000
  
 /*  
  * EventBaseObject wraps a (supposedly) thread-safe libevent dispatch context.
@@ -19,6 +28,20 @@
 typedef struct EventBaseObject { 
     PyObject_HEAD
     struct event_base *ev_base;
+    PyObject *rateLimitGroups;    /* name -> RateLimitGroup */
+    /* Exception policy for errors raised by callbacks */
+    PyObject *errorHandler;       /* called with batches, or None to print */
+    PyObject *errorBatch;         /* [count, type, value, traceback] records */
+    PyObject *errorRecords;       /* traceback signature -> record */
+    PyObject *raisedType;         /* error to re-raise from dispatch() */
+    PyObject *raisedValue;
+    PyObject *raisedTraceback;
+    struct event errorTimer;
+    struct timeval errorInterval;
+    int errorBatchLimit;
+    int stopOnError;
+    long errorCount;
+    long droppedErrors;
 } EventBaseObject;
 
 /* Forward declaration of CPython type object */
@@ -42,6 +65,80 @@ static PyTypeObject Event_Type;
 static PyObject *Event_New(PyTypeObject *, PyObject *, PyObject *);
 static int Event_Init(EventObject *, PyObject *, PyObject *);
 
+/*
+ * ResolverObject wraps an evdns_base bound to an EventBase.  Answers are
+ * kept in an in-process cache for their TTL, and concurrent lookups of the
+ * same name share a single query.
+ */
+typedef struct ResolverObject {
+    PyObject_HEAD
+    struct evdns_base *dns_base;
+    EventBaseObject *eventBase;
+    PyObject *cache;       /* (name, type) -> (expires, result, addresses) */
+    PyObject *inflight;    /* (name, type) -> list of waiting callbacks */
+    double negativeTTL;
+    double maxTTL;
+    int maxEntries;
+    long cacheHits;
+    long cacheMisses;
+    long coalesced;
+} ResolverObject;
+
+/* Forward declaration of CPython type object */
+static PyTypeObject Resolver_Type;
+
+/* Time spent, and bytes delayed, waiting on a token bucket. */
+typedef struct ThrottleStats { 
+    double since;          /* when the current throttle began, or 0 */
+    double seconds;
+    PY_LONG_LONG bytes;
+    size_t counted;        /* bytes already counted, still waiting */
+} ThrottleStats;
+
+/*
+ * RateLimitGroupObject wraps a libevent 'struct bufferevent_rate_limit_group'.
+ * Groups are named, and registered with the EventBase that created them.
+ * The libevent group only exists while the group has members, since its
+ * refill timer would otherwise keep the event loop running.
+ */
+typedef struct RateLimitGroupObject { 
+    PyObject_HEAD
+    struct bufferevent_rate_limit_group *group;
+    struct ev_token_bucket_cfg *cfg;
+    Py_ssize_t minShare;           /* -1 for libevent's default */
+    ev_uint64_t totalRead;         /* totals of libevent groups since freed */
+    ev_uint64_t totalWritten;
+    EventBaseObject *eventBase;
+    PyObject *name;
+    struct BufferEventObject *members;
+    ThrottleStats reads;
+    ThrottleStats writes;
+} RateLimitGroupObject;
+
+/* Forward declaration of CPython type object */
+static PyTypeObject RateLimitGroup_Type;
+
+/*
+ * BufferEventObject wraps a libevent socket 'struct bufferevent'.
+ */
+typedef struct BufferEventObject { 
+    PyObject_HEAD
+    struct bufferevent *bev;
+    struct ev_token_bucket_cfg *rateLimit;
+    EventBaseObject *eventBase;
+    RateLimitGroupObject *rateLimitGroup;
+    struct BufferEventObject *groupNext;     /* other members of the group */
+    struct BufferEventObject *groupPrev;
+    PyObject *readCallback;
+    PyObject *writeCallback;
+    PyObject *errorCallback;
+    ThrottleStats reads;
+    ThrottleStats writes;
+} BufferEventObject;
+
+/* Forward declaration of CPython type object */
+static PyTypeObject BufferEvent_Type;
+
 /* Singleton default event base */
 static EventBaseObject *defaultEventBase;
 
@@ -56,6 +153,11 @@ int EventBase_Check(PyObject *o) {
     return ((o->ob_type) == &EventBase_Type);
 }
 
+/* EventBaseObject error handling prototypes */
+static void __libevent_error_timer_callback(int, short, void *);
+static void __libevent_report_error(EventBaseObject *);
+static void __libevent_release_error_timer(EventBaseObject *);
+
 /* Construct a new EventBaseObject */
 static PyObject *EventBase_New(PyTypeObject *type, PyObject *args, 
 			       PyObject *kwds) 
@@ -68,6 +170,20 @@ static PyObject *EventBase_New(PyTypeObject *type, PyObject *args,
 	if (self->ev_base == NULL)  { 
 	    return NULL;
 	}
+	self->rateLimitGroups = PyDict_New();
+	self->errorBatch = PyList_New(0);
+	self->errorRecords = PyDict_New();
+	if (self->rateLimitGroups == NULL || self->errorBatch == NULL ||
+	    self->errorRecords == NULL) { 
+	    return NULL;
+	}
+	Py_INCREF(Py_None);
+	self->errorHandler = Py_None;
+	self->errorInterval.tv_sec = (long) DEFAULT_ERROR_INTERVAL;
+	self->errorInterval.tv_usec = 0;
+	self->errorBatchLimit = DEFAULT_ERROR_BATCH_LIMIT;
+	evtimer_assign(&self->errorTimer, self->ev_base, 
+		       __libevent_error_timer_callback, self);
     }
     return (PyObject *)self;
 }
@@ -94,15 +210,232 @@ static int EventBase_Init(EventBaseObject *self, PyObject *args,
 
 /* EventBaseObject destructor */
 static void EventBase_Dealloc(EventBaseObject *obj) { 
+    if (obj->errorBatch != NULL)
+	evtimer_del(&obj->errorTimer);
+    Py_XDECREF(obj->rateLimitGroups);
+    Py_XDECREF(obj->errorHandler);
+    Py_XDECREF(obj->errorBatch);
+    Py_XDECREF(obj->errorRecords);
+    Py_XDECREF(obj->raisedType);
+    Py_XDECREF(obj->raisedValue);
+    Py_XDECREF(obj->raisedTraceback);
     obj->ob_type->tp_free((PyObject *)obj);
 }	
 
+/* Current time according to an event base, in seconds. */
+static double __libevent_base_now(EventBaseObject *base) { 
+    struct timeval tv;
+
+    event_base_gettimeofday_cached(base->ev_base, &tv);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+/* 
+ * Identify an error by its type and the file and line of every frame in its
+ * traceback, so repeats of the same failure can be counted instead of
+ * reported one by one.
+ */
+static PyObject *__libevent_error_signature(PyObject *type, PyObject *tb) { 
+    PyObject          *sig = PyList_New(0);
+    PyObject          *item, *tuple;
+    PyTracebackObject *frame;
+
+    if (sig == NULL || PyList_Append(sig, type) < 0)
+	goto error;
+    for (frame = (PyTracebackObject *)tb; 
+	 frame != NULL && (PyObject *)frame != Py_None; 
+	 frame = frame->tb_next) { 
+	item = Py_BuildValue("(Oi)", frame->tb_frame->f_code->co_filename,
+			     frame->tb_lineno);
+	if (item == NULL || PyList_Append(sig, item) < 0) { 
+	    Py_XDECREF(item);
+	    goto error;
+	}
+	Py_DECREF(item);
+    }
+    tuple = PyList_AsTuple(sig);
+    Py_DECREF(sig);
+    return tuple;
+
+ error:
+    Py_XDECREF(sig);
+    return NULL;
+}
+
+/* 
+ * Hand every queued error to the error handler in a single call, or print
+ * each distinct one once if there is no handler.
+ */
+static void __libevent_flush_errors(EventBaseObject *self) { 
+    PyObject   *batch, *records, *record, *rv;
+    Py_ssize_t  i;
+    long        count;
+
+    evtimer_del(&self->errorTimer);
+    if (PyList_GET_SIZE(self->errorBatch) == 0)
+	return;
+
+    records = self->errorBatch;
+    self->errorBatch = PyList_New(0);
+    PyDict_Clear(self->errorRecords);
+    if (self->errorBatch == NULL) { 
+	/* Keep going with what we had, rather than lose the errors. */
+	self->errorBatch = records;
+	PyErr_Clear();
+	return;
+    }
+    batch = PyList_New(PyList_GET_SIZE(records));
+    for (i = 0; batch != NULL && i < PyList_GET_SIZE(records); i++) { 
+	record = PyList_AsTuple(PyList_GET_ITEM(records, i));
+	if (record == NULL) { 
+	    Py_CLEAR(batch);
+	    break;
+	}
+	PyList_SET_ITEM(batch, i, record);
+    }
+
+    if (batch == NULL) { 
+	PyErr_Clear();
+    }
+    else if (self->errorHandler != Py_None) { 
+	rv = PyObject_CallFunctionObjArgs(self->errorHandler, batch, NULL);
+	if (rv == NULL)
+	    PyErr_WriteUnraisable(self->errorHandler);
+	Py_XDECREF(rv);
+    }
+    else { 
+	for (i = 0; i < PyList_GET_SIZE(records); i++) { 
+	    record = PyList_GET_ITEM(records, i);
+	    count = PyInt_AsLong(PyList_GET_ITEM(record, 0));
+	    PyErr_Display(PyList_GET_ITEM(record, 1), 
+			  PyList_GET_ITEM(record, 2), 
+			  PyList_GET_ITEM(record, 3));
+	    if (count > 1)
+		PySys_WriteStderr("(the error above occurred %ld times)\n", 
+				  count);
+	}
+    }
+    Py_XDECREF(batch);
+    Py_DECREF(records);
+}
+
+static void __libevent_error_timer_callback(int fd, short events, void *arg) {
+    __libevent_flush_errors((EventBaseObject *)arg);
+}
+
+/* 
+ * The error timer must never be what keeps dispatch() running.  Once it is
+ * the only event left, drop it so the loop can return; dispatch() and loop()
+ * flush the queued errors on the way out.  Called after every Python 
+ * callback, since a callback may have removed the last other event.
+ */
+static void __libevent_release_error_timer(EventBaseObject *base) { 
+    if (base == NULL)
+	base = defaultEventBase;
+    if (evtimer_pending(&base->errorTimer, NULL) &&
+	event_base_get_num_events(base->ev_base, EVENT_BASE_COUNT_ADDED |
+				  EVENT_BASE_COUNT_ACTIVE) <= 1)
+	evtimer_del(&base->errorTimer);
+}
+
+/* 
+ * Called by the callback thunks when a Python callback raises.  Depending on
+ * the base's policy, the error either stops the loop to be re-raised from
+ * dispatch()/loop(), or is queued for the error handler.  Repeats of an
+ * error already queued only bump its count, and at most errorBatchLimit
+ * distinct errors are queued between flushes.  SystemExit and 
+ * KeyboardInterrupt are never queued: they always stop the loop and are
+ * re-raised, so sys.exit() in a callback still ends the program.
+ */
+static void __libevent_report_error(EventBaseObject *base) { 
+    PyObject *type, *value, *tb, *sig, *record, *count;
+
+    if (base == NULL)
+	base = defaultEventBase;
+    if (PyErr_ExceptionMatches(PyExc_SystemExit) ||
+	PyErr_ExceptionMatches(PyExc_KeyboardInterrupt)) { 
+	/* Takes precedence over an error held for stopOnError. */
+	Py_XDECREF(base->raisedType);
+	Py_XDECREF(base->raisedValue);
+	Py_XDECREF(base->raisedTraceback);
+	PyErr_Fetch(&base->raisedType, &base->raisedValue, 
+		    &base->raisedTraceback);
+	PyErr_NormalizeException(&base->raisedType, &base->raisedValue, 
+				 &base->raisedTraceback);
+	event_base_loopbreak(base->ev_base);
+	return;
+    }
+    PyErr_Fetch(&type, &value, &tb);
+    PyErr_NormalizeException(&type, &value, &tb);
+    base->errorCount++;
+
+    if (base->stopOnError && base->raisedType == NULL) { 
+	base->raisedType = type;
+	base->raisedValue = value;
+	base->raisedTraceback = tb;
+	event_base_loopbreak(base->ev_base);
+	return;
+    }
+
+    sig = __libevent_error_signature(type, tb);
+    if (sig == NULL) { 
+	PyErr_Clear();
+	base->droppedErrors++;
+	goto done;
+    }
+    record = PyDict_GetItem(base->errorRecords, sig);
+    if (record != NULL) { 
+	count = PyInt_FromLong(PyInt_AsLong(PyList_GET_ITEM(record, 0)) + 1);
+	if (count != NULL)
+	    PyList_SetItem(record, 0, count);
+	goto done;
+    }
+    if (PyList_GET_SIZE(base->errorBatch) >= base->errorBatchLimit) { 
+	base->droppedErrors++;
+	goto done;
+    }
+
+    record = Py_BuildValue("[iOOO]", 1, type, 
+			   value ? value : Py_None, tb ? tb : Py_None);
+    if (record == NULL || PyList_Append(base->errorBatch, record) < 0 ||
+	PyDict_SetItem(base->errorRecords, sig, record) < 0) { 
+	PyErr_Clear();
+	base->droppedErrors++;
+    }
+    Py_XDECREF(record);
+    if (!evtimer_pending(&base->errorTimer, NULL))
+	evtimer_add(&base->errorTimer, &base->errorInterval);
+    __libevent_release_error_timer(base);
+
+ done:
+    Py_XDECREF(sig);
+    Py_XDECREF(type);
+    Py_XDECREF(value);
+    Py_XDECREF(tb);
+}
+
+/* 
+ * Finish a loop()/dispatch() call: re-raise a callback's error if the
+ * policy asked us to stop on one.
+ */
+static PyObject *__libevent_loop_result(EventBaseObject *self, int rv) { 
+    if (self->raisedType != NULL) { 
+	PyErr_Restore(self->raisedType, self->raisedValue, 
+		      self->raisedTraceback);
+	self->raisedType = self->raisedValue = self->raisedTraceback = NULL;
+	return NULL;
+    }
+    return PyInt_FromLong(rv);
+}
+
 /* EventBaseObject methods */
 PyDoc_STRVAR(EventBase_LoopDoc,
 "loop(self, [flags=0])\n\
 \n\
 Perform one iteration of the event loop.  Valid flags arg EVLOOP_NONBLOCK \n\
-and EVLOOP_ONCE.");
+and EVLOOP_ONCE.  If the error policy says to stop on errors, an exception\n\
+raised by a callback is re-raised here.  Queued errors are delivered before\n\
+it returns if nothing else is left for the loop to wait on.");
 static PyObject *EventBase_Loop(EventBaseObject *self, PyObject *args, 
 				PyObject *kwargs) 
 { 
@@ -114,7 +447,9 @@ static PyObject *EventBase_Loop(EventBaseObject *self, PyObject *args,
 	return NULL;
     
     rv = event_base_loop(self->ev_base, flags);
-    return PyInt_FromLong(rv);
+    if (!evtimer_pending(&self->errorTimer, NULL))
+	__libevent_flush_errors(self);
+    return __libevent_loop_result(self, rv);
 }
 PyDoc_STRVAR(EventBase_LoopExitDoc,
 "loopExit(self, seconds=0)\n\
@@ -142,12 +477,14 @@ PyDoc_STRVAR(EventBase_DispatchDoc,
 \n\
 Run the main dispatch loop associated with this event base.  This function\n\
 only terminates when no events remain, or the loop is terminated via an \n\
-explicit call to EventBase.loopExit() or via a signal.");
+explicit call to EventBase.loopExit() or via a signal.  Errors queued by\n\
+callbacks are delivered before it returns.");
 static PyObject *EventBase_Dispatch(EventBaseObject *self, PyObject *args,
 				    PyObject *kwargs) { 
 
     int rv = event_base_dispatch(self->ev_base);
-    return PyInt_FromLong(rv);
+    __libevent_flush_errors(self);
+    return __libevent_loop_result(self, rv);
 
 }
 
@@ -224,12 +561,186 @@ static EventObject *EventBase_CreateSignalHandler(EventBaseObject *self,
     return newSigHandler;
 }
 
+PyDoc_STRVAR(EventBase_CreateResolverDoc,
+"createResolver(self, initialize=True) -> new Resolver\n\
+\n\
+Create a new asynchronous DNS Resolver bound to this event base.  If\n\
+<initialize> is true, nameservers are read from /etc/resolv.conf.");
+static ResolverObject *EventBase_CreateResolver(EventBaseObject *self,
+						PyObject *args,
+						PyObject *kwargs) {
+    static char *kwlist[] = {"initialize", NULL};
+    int          initialize = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i:createResolver",
+				     kwlist, &initialize))
+	return NULL;
+
+    return (ResolverObject *)PyObject_CallFunction((PyObject *)&Resolver_Type,
+						   "Oi", self, initialize);
+}
+
+PyDoc_STRVAR(EventBase_CreateBufferEventDoc,
+"createBufferEvent(self, fd, readCallback=None, writeCallback=None,\n\
+                  errorCallback=None) -> new BufferEvent\n\
+\n\
+Create a new BufferEvent for the given socket, bound to this event base.");
+static BufferEventObject *EventBase_CreateBufferEvent(EventBaseObject *self,
+						      PyObject *args,
+						      PyObject *kwargs) {
+    static char *kwlist[] = {"fd", "readCallback", "writeCallback", 
+			     "errorCallback", NULL};
+    PyObject    *fdObj = NULL;
+    PyObject    *readCallback = Py_None;
+    PyObject    *writeCallback = Py_None;
+    PyObject    *errorCallback = Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OOO:createBufferEvent",
+				     kwlist, &fdObj, &readCallback, 
+				     &writeCallback, &errorCallback))
+	return NULL;
+
+    return (BufferEventObject *)PyObject_CallFunction(
+	(PyObject *)&BufferEvent_Type, "OOOOO", fdObj, readCallback,
+	writeCallback, errorCallback, self);
+}
+
+PyDoc_STRVAR(EventBase_CreateRateLimitGroupDoc,
+"createRateLimitGroup(self, name, readRate=0, readBurst=0, writeRate=0,\n\
+                     writeBurst=0, tick=1.0) -> new RateLimitGroup\n\
+\n\
+Create a token-bucket rate limit shared by every BufferEvent that joins it,\n\
+and register it in rateLimitGroups under <name>.  Rates are in bytes per\n\
+<tick> seconds; a rate of 0 means unlimited, and a burst of 0 means the\n\
+same as the rate.  The event base keeps the group alive until it is\n\
+removed with removeRateLimitGroup().  While the group has members, its\n\
+refill timer keeps dispatch() running; an empty group does not.");
+static RateLimitGroupObject *EventBase_CreateRateLimitGroup(
+    EventBaseObject *self, PyObject *args, PyObject *kwargs) 
+{
+    static char          *kwlist[] = {"name", "readRate", "readBurst", 
+				      "writeRate", "writeBurst", "tick", NULL};
+    PyObject             *name = NULL;
+    Py_ssize_t            readRate = 0, readBurst = 0;
+    Py_ssize_t            writeRate = 0, writeBurst = 0;
+    double                tick = 1.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, 
+				     "S|nnnnd:createRateLimitGroup", kwlist, 
+				     &name, &readRate, &readBurst, 
+				     &writeRate, &writeBurst, &tick))
+	return NULL;
+
+    return (RateLimitGroupObject *)PyObject_CallFunction(
+	(PyObject *)&RateLimitGroup_Type, "OOnnnnd", name, self, readRate, 
+	readBurst, writeRate, writeBurst, tick);
+}
+
+PyDoc_STRVAR(EventBase_RemoveRateLimitGroupDoc,
+"removeRateLimitGroup(self, name)\n\
+\n\
+Remove the rate limit group registered under <name>.  Connections still in\n\
+the group stay limited by it, and keep dispatch() running, until the last\n\
+of them leaves and the group is freed.  <name> may be used for a new group\n\
+straight away.");
+static PyObject *EventBase_RemoveRateLimitGroup(EventBaseObject *self, 
+						PyObject *args, 
+						PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"name", NULL};
+    PyObject    *name = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "S:removeRateLimitGroup",
+				     kwlist, &name))
+	return NULL;
+
+    if (PyDict_GetItem(self->rateLimitGroups, name) == NULL) { 
+	PyErr_Format(EventErrorObject, "no rate limit group named '%s'",
+		     PyString_AS_STRING(name));
+	return NULL;
+    }
+    if (PyDict_DelItem(self->rateLimitGroups, name) < 0)
+	return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(EventBase_SetErrorHandlerDoc,
+"setErrorHandler(self, handler=None, interval=1.0, batchLimit=100,\n\
+                stopOnError=False)\n\
+\n\
+Set the policy for exceptions raised by callbacks on this event base.\n\
+Errors are queued, and every <interval> seconds <handler> is called once\n\
+with a list of (count, type, value, traceback) tuples.  Repeats of an error\n\
+with the same type and traceback are counted rather than queued again, and\n\
+at most <batchLimit> distinct errors are kept per batch.  With no handler,\n\
+each distinct error is printed to stderr once per batch.  If <stopOnError>\n\
+is true, the first error stops the loop and is re-raised from dispatch()\n\
+or loop().  SystemExit and KeyboardInterrupt always do.");
+static PyObject *EventBase_SetErrorHandler(EventBaseObject *self, 
+					   PyObject *args, PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"handler", "interval", "batchLimit", 
+			     "stopOnError", NULL};
+    PyObject    *handler = Py_None;
+    double       interval = DEFAULT_ERROR_INTERVAL;
+    int          batchLimit = DEFAULT_ERROR_BATCH_LIMIT;
+    int          stopOnError = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Odii:setErrorHandler", 
+				     kwlist, &handler, &interval, &batchLimit,
+				     &stopOnError))
+	return NULL;
+
+    if (handler != Py_None && !PyCallable_Check(handler)) { 
+	PyErr_SetString(EventErrorObject, "error handler is not a callable");
+	return NULL;
+    }
+    if (interval < 0.0 || batchLimit < 1) { 
+	PyErr_SetString(EventErrorObject, 
+			"interval must be >= 0, and batchLimit must be >= 1");
+	return NULL;
+    }
+
+    /* Deliver anything queued under the old policy first. */
+    __libevent_flush_errors(self);
+    Py_INCREF(handler);
+    Py_DECREF(self->errorHandler);
+    self->errorHandler = handler;
+    self->errorInterval.tv_sec = (long) interval;
+    self->errorInterval.tv_usec = (interval - (long) interval) * 1000000;
+    self->errorBatchLimit = batchLimit;
+    self->stopOnError = stopOnError;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(EventBase_FlushErrorsDoc,
+"flushErrors(self)\n\
+\n\
+Deliver any queued callback errors to the error handler now.");
+static PyObject *EventBase_FlushErrors(EventBaseObject *self, PyObject *args,
+				       PyObject *kwargs) 
+{ 
+    __libevent_flush_errors(self);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 
 static PyGetSetDef EventBase_Properties[] = {
     {NULL},
 };
 
 static PyMemberDef EventBase_Members[] = {
+    {"rateLimitGroups", T_OBJECT, offsetof(EventBaseObject, rateLimitGroups),
+     RO, "Rate limit groups created on this event base, by name"},
+    {"errorHandler",    T_OBJECT, offsetof(EventBaseObject, errorHandler),
+     RO, "Called with batches of errors raised by callbacks"},
+    {"errorCount",      T_LONG,   offsetof(EventBaseObject, errorCount),
+     RO, "Number of errors raised by callbacks"},
+    {"droppedErrors",   T_LONG,   offsetof(EventBaseObject, droppedErrors),
+     RO, "Number of errors discarded because a batch was full"},
     {NULL},
 };
 
@@ -245,6 +756,18 @@ static PyMethodDef EventBase_Methods[] = {
      METH_VARARGS|METH_KEYWORDS, EventBase_CreateSignalHandlerDoc},
     {"createTimer",              (PyCFunction)EventBase_CreateTimer, 
      METH_VARARGS|METH_KEYWORDS, EventBase_CreateTimerDoc},
+    {"createResolver",           (PyCFunction)EventBase_CreateResolver,
+     METH_VARARGS|METH_KEYWORDS, EventBase_CreateResolverDoc},
+    {"createBufferEvent",        (PyCFunction)EventBase_CreateBufferEvent,
+     METH_VARARGS|METH_KEYWORDS, EventBase_CreateBufferEventDoc},
+    {"createRateLimitGroup",     (PyCFunction)EventBase_CreateRateLimitGroup,
+     METH_VARARGS|METH_KEYWORDS, EventBase_CreateRateLimitGroupDoc},
+    {"removeRateLimitGroup",     (PyCFunction)EventBase_RemoveRateLimitGroup,
+     METH_VARARGS|METH_KEYWORDS, EventBase_RemoveRateLimitGroupDoc},
+    {"setErrorHandler",          (PyCFunction)EventBase_SetErrorHandler,
+     METH_VARARGS|METH_KEYWORDS, EventBase_SetErrorHandlerDoc},
+    {"flushErrors",              (PyCFunction)EventBase_FlushErrors,
+     METH_NOARGS,                EventBase_FlushErrorsDoc},
     {"dispatch",                 (PyCFunction)EventBase_Dispatch,
      METH_NOARGS,                EventBase_DispatchDoc},
     {NULL},
@@ -328,26 +851,14 @@ static void __libevent_ev_callback(int fd, short events, void *arg) {
     //Py_DECREF(tuple);
     if (result) { 
 	Py_DECREF(result);
+	__libevent_release_error_timer(ev->eventBase);
     }
     else { 
-      /* 
-       * The callback raised an exception. This usually isnt a problem because
-       * the callback's caller is in Python-land. Here, we don't have many
-       * good options.  For now, we just print the exception.  The commented
-       * out code below is supposed to asynchronously raise an exception in
-       * the main thread, but that doesn't work if libevent is blocked on
-       * an I/O call like select() or kevent().  We could terminate the 
-       * event loop from here, but that seems a little drastic.  Somehow,
-       * we should move the callback invocation to Python.  I think.
-       */
-      /* 
-       PyThreadState  *ts = PyThreadState_Get();
-       int r  = PyThreadState_SetAsyncExc(ts->thread_id, EventErrorObject);
-       printf("%d\n", r);
-      */
-      PyErr_Print();
-      PyErr_WriteUnraisable(ev->callback);
-
+	/* 
+	 * The callback raised an exception.  There's no Python caller to
+	 * hand it to, so it goes to the event base's error policy.
+	 */
+	__libevent_report_error(ev->eventBase);
     }
 }
 
@@ -626,55 +1137,1758 @@ static PyTypeObject Event_Type = {
 };
 
 
+/* Typechecker */
+int Resolver_Check(PyObject *o) { 
+    return ((o->ob_type) == &Resolver_Type);
+}
+
+/* Construct a new ResolverObject */
+static PyObject *Resolver_New(PyTypeObject *type, PyObject *args, 
+			      PyObject *kwargs) 
+{
+    ResolverObject *self = NULL;
+    assert(type != NULL && type->tp_alloc != NULL);
+    self = (ResolverObject *)type->tp_alloc(type, 0);
+    if (self != NULL) { 
+	self->dns_base = NULL;
+	self->eventBase = NULL;
+	self->cache = PyDict_New();
+	self->inflight = PyDict_New();
+	if (self->cache == NULL || self->inflight == NULL) { 
+	    Py_DECREF(self);
+	    return NULL;
+	}
+	self->negativeTTL = 30.0;
+	self->maxTTL = 3600.0;
+	self->maxEntries = DEFAULT_RESOLVER_MAX_ENTRIES;
+    }
+    return (PyObject *)self;
+}
+
+/* ResolverObject initializer */
+static int Resolver_Init(ResolverObject *self, PyObject *args, 
+			 PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"eventBase", "initialize", NULL};
+    PyObject    *eventBase = NULL;
+    int          initialize = 1;
+    int          flags = EVDNS_BASE_DISABLE_WHEN_INACTIVE;
 
-static PyObject *EventModule_setLogCallback(PyObject *self, PyObject *args, 
-					    PyObject *kwargs) { 
-    static char  *kwlist[] = {"callback", NULL};
-	
-    if (!PyArg_ParseTupleAndKeywords(args,kwargs,"O:setLogCallback", kwlist, 
-				     &logCallback))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Oi:Resolver", kwlist, 
+				     &eventBase, &initialize))
+	return -1;
+
+    if (eventBase == NULL || eventBase == Py_None)
+	eventBase = (PyObject *)defaultEventBase;
+    if (!EventBase_Check(eventBase)) { 
+	PyErr_SetString(EventErrorObject, "argument is not an EventBase object");
+	return -1;
+    }
+    if (PyDict_Size(self->inflight) > 0) { 
+	PyErr_SetString(EventErrorObject, 
+			"cannot reinitialize a resolver with lookups in flight");
+	return -1;
+    }
+    if (self->dns_base != NULL) { 
+	evdns_base_free(self->dns_base, 0);
+	self->dns_base = NULL;
+    }
+
+    if (initialize)
+	flags |= EVDNS_BASE_INITIALIZE_NAMESERVERS;
+    self->dns_base = evdns_base_new(((EventBaseObject *)eventBase)->ev_base,
+				    flags);
+    if (self->dns_base == NULL) { 
+	PyErr_SetString(EventErrorObject, "unable to create DNS resolver");
+	return -1;
+    }
+
+    Py_XDECREF(self->eventBase);
+    Py_INCREF(eventBase);
+    self->eventBase = (EventBaseObject *)eventBase;
+    PyDict_Clear(self->cache);
+    return 0;
+}
+
+/* Raise EventError unless __init__ has set the resolver up. */
+static int __libevent_resolver_ready(ResolverObject *self) { 
+    if (self->dns_base == NULL) { 
+	PyErr_SetString(EventErrorObject, "resolver is not initialized");
+	return 0;
+    }
+    return 1;
+}
+
+/* ResolverObject destructor */
+static void Resolver_Dealloc(ResolverObject *obj) { 
+    /* Lookups in flight hold a reference, so none can be outstanding here. */
+    if (obj->dns_base != NULL)
+	evdns_base_free(obj->dns_base, 0);
+    Py_XDECREF(obj->eventBase);
+    Py_XDECREF(obj->cache);
+    Py_XDECREF(obj->inflight);
+    obj->ob_type->tp_free((PyObject *)obj);
+}	
+
+/* Build a list of address strings from an evdns answer. */
+static PyObject *__libevent_resolver_addresses(char type, int count, 
+					       void *addresses) 
+{ 
+    PyObject *list = PyList_New(0);
+    PyObject *addr;
+    char      buf[INET6_ADDRSTRLEN];
+    int       i;
+
+    if (list == NULL)
 	return NULL;
-    
-    if (!PyCallable_Check(logCallback)) { 
-        PyErr_SetString(EventErrorObject, "log callback is not a callable");
-	logCallback = NULL;
+    for (i = 0; i < count; i++) { 
+	if (type == DNS_IPv4_A) 
+	    inet_ntop(AF_INET, (ev_uint32_t *)addresses + i, buf, sizeof(buf));
+	else if (type == DNS_IPv6_AAAA)
+	    inet_ntop(AF_INET6, (struct in6_addr *)addresses + i, 
+		      buf, sizeof(buf));
+	else
+	    break;
+	addr = PyString_FromString(buf);
+	if (addr == NULL || PyList_Append(list, addr) < 0) { 
+	    Py_XDECREF(addr);
+	    Py_DECREF(list);
+	    return NULL;
+	}
+	Py_DECREF(addr);
+    }
+    return list;
+}
+
+/* 
+ * Make room in a full cache.  Expired entries go first; if that isn't
+ * enough, the entries closest to expiry are dropped until the cache is a
+ * quarter empty, so a stream of new names doesn't pay for a trim each time.
+ */
+static int __libevent_resolver_trim(ResolverObject *self) { 
+    PyObject   *key, *entry, *item, *byExpiry;
+    Py_ssize_t  pos = 0, i, target;
+    double      now = __libevent_base_now(self->eventBase);
+
+    byExpiry = PyList_New(0);
+    if (byExpiry == NULL)
+	return -1;
+    while (PyDict_Next(self->cache, &pos, &key, &entry)) { 
+	item = PyTuple_Pack(2, PyTuple_GET_ITEM(entry, 0), key);
+	if (item == NULL || PyList_Append(byExpiry, item) < 0) { 
+	    Py_XDECREF(item);
+	    Py_DECREF(byExpiry);
+	    return -1;
+	}
+	Py_DECREF(item);
+    }
+    if (PyList_Sort(byExpiry) < 0) { 
+	Py_DECREF(byExpiry);
+	return -1;
+    }
+
+    target = self->maxEntries - (self->maxEntries + 3) / 4;
+    for (i = 0; i < PyList_GET_SIZE(byExpiry); i++) { 
+	item = PyList_GET_ITEM(byExpiry, i);
+	if (PyFloat_AS_DOUBLE(PyTuple_GET_ITEM(item, 0)) > now &&
+	    PyDict_Size(self->cache) <= target)
+	    break;
+	if (PyDict_DelItem(self->cache, PyTuple_GET_ITEM(item, 1)) < 0) { 
+	    Py_DECREF(byExpiry);
+	    return -1;
+	}
+    }
+    Py_DECREF(byExpiry);
+    return 0;
+}
+
+/* 
+ * Build the cache key for a lookup.  DNS names are case-insensitive, so case
+ * is folded.  A trailing dot is kept: 'db.' is an absolute name, while 'db'
+ * may be expanded with the search domains, so they can differ.
+ */
+static PyObject *__libevent_resolver_key(const char *hostname, int type) { 
+    PyObject   *name, *key;
+    char       *p;
+
+    name = PyString_FromString(hostname);
+    if (name == NULL)
 	return NULL;
+    for (p = PyString_AS_STRING(name); *p; p++)
+	*p = Py_TOLOWER(*p);
+    key = Py_BuildValue("(Ni)", name, type);
+    return key;
+}
+
+/* State carried through an in-flight evdns lookup */
+typedef struct ResolverRequest { 
+    ResolverObject *resolver;
+    PyObject       *key;
+} ResolverRequest;
+
+/* evdns callback thunk: cache the answer and run every waiting callback. */
+static void __libevent_resolver_callback(int result, char type, int count, 
+					 int ttl, void *addresses, void *arg) 
+{ 
+    ResolverRequest *req = arg;
+    ResolverObject  *self = req->resolver;
+    PyObject        *key = req->key;
+    PyObject        *addrs, *waiters, *entry, *waiter, *copy, *rv;
+    double           cacheFor = 0.0;
+    Py_ssize_t       i;
+
+    free(req);
+
+    waiters = PyDict_GetItem(self->inflight, key);
+    Py_XINCREF(waiters);
+    PyDict_DelItem(self->inflight, key);
+
+    addrs = __libevent_resolver_addresses(type, count, addresses);
+    if (addrs == NULL) { 
+	/* 
+	 * Couldn't convert the answer.  Report that, but still answer every
+	 * waiter, as an uncached DNS_ERR_UNKNOWN with no addresses, so no
+	 * lookup is left hanging.
+	 */
+	__libevent_report_error(self->eventBase);
+	result = DNS_ERR_UNKNOWN;
+	addrs = PyList_New(0);
+	if (addrs == NULL) { 
+	    __libevent_report_error(self->eventBase);
+	    goto done;
+	}
     }
-    Py_INCREF(Py_None);
-    return Py_None;
+
+    /* 
+     * Positive answers live for their TTL (capped at maxTTL).  Names that
+     * don't exist, or have no records of this type, are cached for 
+     * negativeTTL.  Transient failures (timeouts, SERVFAIL, ...) are not
+     * cached at all.  The cache keeps the addresses as a tuple, and every
+     * callback gets its own list, so a callback can't alter the cache or
+     * what other callbacks see.
+     */
+    if (result == DNS_ERR_NONE)
+	cacheFor = ttl < self->maxTTL ? ttl : self->maxTTL;
+    else if (result == DNS_ERR_NOTEXIST || result == DNS_ERR_NODATA)
+	cacheFor = self->negativeTTL;
+    if (cacheFor > 0 && self->maxEntries > 0) { 
+	entry = Py_BuildValue("(diN)", __libevent_base_now(self->eventBase) + cacheFor,
+			      result, PyList_AsTuple(addrs));
+	if (entry == NULL ||
+	    (PyDict_Size(self->cache) >= self->maxEntries && 
+	     __libevent_resolver_trim(self) < 0) ||
+	    PyDict_SetItem(self->cache, key, entry) < 0)
+	    __libevent_report_error(self->eventBase);
+	Py_XDECREF(entry);
+    }
+
+    for (i = 0; waiters != NULL && i < PyList_GET_SIZE(waiters); i++) { 
+	/* Each waiter is a (hostname, callback) pair. */
+	waiter = PyList_GET_ITEM(waiters, i);
+	copy = PyList_GetSlice(addrs, 0, PyList_GET_SIZE(addrs));
+	rv = copy == NULL ? NULL :
+	    PyObject_CallFunction(PyTuple_GET_ITEM(waiter, 1), "OiN", 
+				  PyTuple_GET_ITEM(waiter, 0), result, copy);
+	if (rv == NULL) 
+	    __libevent_report_error(self->eventBase);
+	Py_XDECREF(rv);
+    }
+    Py_DECREF(addrs);
+    __libevent_release_error_timer(self->eventBase);
+
+ done:
+    Py_XDECREF(waiters);
+    Py_DECREF(key);
+    Py_DECREF(self);
 }
 
-static PyMethodDef EventModule_Functions[] = { 
-    {"setLogCallback", (PyCFunction)EventModule_setLogCallback, 
-     METH_VARARGS|METH_KEYWORDS},	
-    {NULL},
-};
+/* A cached answer waiting to be delivered on the next loop turn */
+typedef struct ResolverAnswer { 
+    ResolverObject *resolver;
+    PyObject       *callback;
+    PyObject       *args;          /* (hostname, result, addresses) */
+} ResolverAnswer;
+
+/* event_base_once thunk: deliver a cached answer. */
+static void __libevent_resolver_deliver(int fd, short events, void *arg) { 
+    ResolverAnswer *answer = arg;
+    PyObject       *rv;
+
+    rv = PyObject_Call(answer->callback, answer->args, NULL);
+    if (rv == NULL)
+	__libevent_report_error(answer->resolver->eventBase);
+    Py_XDECREF(rv);
+    __libevent_release_error_timer(answer->resolver->eventBase);
+    Py_DECREF(answer->callback);
+    Py_DECREF(answer->args);
+    Py_DECREF(answer->resolver);
+    free(answer);
+}
 
-#define ADDCONST(mod, name, const)  PyModule_AddIntConstant(mod, name, const)
-DL_EXPORT(void) initevent(void)
-{
-    PyObject       *m, *d;
-	
-    m = Py_InitModule("event", EventModule_Functions);
-    d = PyModule_GetDict(m);
+PyDoc_STRVAR(Resolver_ResolveDoc,
+"resolve(self, hostname, callback, ipv6=False)\n\
+\n\
+Look up the addresses for <hostname> and call <callback> with a 3-tuple of\n\
+(hostname, result, addresses), where result is one of the DNS_ERR_*\n\
+constants and addresses is a list of address strings.  The callback always\n\
+runs from the event loop, on the next loop turn if the answer is cached.\n\
+Names are compared case-insensitively, and concurrent lookups\n\
+of the same name share a single query.");
+static PyObject *Resolver_Resolve(ResolverObject *self, PyObject *args, 
+				  PyObject *kwargs) 
+{ 
+    static char     *kwlist[] = {"hostname", "callback", "ipv6", NULL};
+    char            *hostname = NULL;
+    PyObject        *callback = NULL;
+    int              ipv6 = 0;
+    int              type;
+    PyObject        *key, *entry, *waiter, *waiters;
+    ResolverRequest *req;
+    ResolverAnswer  *answer;
+    struct timeval   now = {0, 0};
+    struct evdns_request *dnsreq;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO|i:resolve", kwlist,
+				     &hostname, &callback, &ipv6))
+	return NULL;
+    if (!__libevent_resolver_ready(self))
+	return NULL;
 
-    if (EventErrorObject == NULL) {
-	EventErrorObject = PyErr_NewException("libevent.EventError", 
-					      NULL, NULL);
-        if (EventErrorObject == NULL)
-            return;
+    if (!PyCallable_Check(callback)) {
+	PyErr_SetString(EventErrorObject,"callback argument must be callable");
+	return NULL;
     }
-    Py_INCREF(EventErrorObject);
-    PyModule_AddObject(m, "EventError", EventErrorObject);
 
-    if (PyType_Ready(&EventBase_Type) < 0) { 
-	return;
+    type = ipv6 ? DNS_IPv6_AAAA : DNS_IPv4_A;
+    key = __libevent_resolver_key(hostname, type);
+    if (key == NULL)
+	return NULL;
+
+    /* Answer from the cache if we have a live entry */
+    entry = PyDict_GetItem(self->cache, key);
+    if (entry != NULL) { 
+	if (__libevent_base_now(self->eventBase) < 
+	    PyFloat_AS_DOUBLE(PyTuple_GET_ITEM(entry, 0))) { 
+	    Py_DECREF(key);
+	    answer = malloc(sizeof(ResolverAnswer));
+	    if (answer == NULL)
+		return PyErr_NoMemory();
+	    answer->args = Py_BuildValue("(sON)", hostname,
+					 PyTuple_GET_ITEM(entry, 1),
+					 PySequence_List(
+					     PyTuple_GET_ITEM(entry, 2)));
+	    if (answer->args == NULL) { 
+		free(answer);
+		return NULL;
+	    }
+	    if (event_base_once(self->eventBase->ev_base, -1, EV_TIMEOUT,
+				__libevent_resolver_deliver, answer, 
+				&now) < 0) { 
+		Py_DECREF(answer->args);
+		free(answer);
+		PyErr_SetString(EventErrorObject, 
+				"unable to schedule cached answer");
+		return NULL;
+	    }
+	    Py_INCREF(self);
+	    answer->resolver = self;
+	    Py_INCREF(callback);
+	    answer->callback = callback;
+	    self->cacheHits++;
+	    Py_INCREF(Py_None);
+	    return Py_None;
+	}
+	PyDict_DelItem(self->cache, key);
     }
-    PyModule_AddObject(m, "EventBase", (PyObject *)&EventBase_Type);
-    
-    if (PyType_Ready(&Event_Type) < 0)
-	return;
-    PyModule_AddObject(m, "Event", (PyObject *)&Event_Type);	
+    self->cacheMisses++;
+
+    waiter = Py_BuildValue("(sO)", hostname, callback);
+    if (waiter == NULL) { 
+	Py_DECREF(key);
+	return NULL;
+    }
+
+    /* Piggyback on a query that is already in flight */
+    waiters = PyDict_GetItem(self->inflight, key);
+    if (waiters != NULL) { 
+	Py_DECREF(key);
+	if (PyList_Append(waiters, waiter) < 0) { 
+	    Py_DECREF(waiter);
+	    return NULL;
+	}
+	Py_DECREF(waiter);
+	self->coalesced++;
+	Py_INCREF(Py_None);
+	return Py_None;
+    }
+
+    waiters = Py_BuildValue("[N]", waiter);
+    if (waiters == NULL || PyDict_SetItem(self->inflight, key, waiters) < 0) { 
+	Py_XDECREF(waiters);
+	Py_DECREF(key);
+	return NULL;
+    }
+    Py_DECREF(waiters);
+
+    req = malloc(sizeof(ResolverRequest));
+    if (req == NULL) { 
+	PyDict_DelItem(self->inflight, key);
+	Py_DECREF(key);
+	return PyErr_NoMemory();
+    }
+    /* The request owns our reference to key, and one to the resolver. */
+    Py_INCREF(self);
+    req->resolver = self;
+    req->key = key;
+
+    hostname = PyString_AS_STRING(PyTuple_GET_ITEM(key, 0));
+    if (ipv6)
+	dnsreq = evdns_base_resolve_ipv6(self->dns_base, hostname, 0,
+					 __libevent_resolver_callback, req);
+    else
+	dnsreq = evdns_base_resolve_ipv4(self->dns_base, hostname, 0,
+					 __libevent_resolver_callback, req);
+    if (dnsreq == NULL) { 
+	PyDict_DelItem(self->inflight, key);
+	free(req);
+	Py_DECREF(key);
+	Py_DECREF(self);
+	PyErr_SetString(EventErrorObject, "unable to start DNS lookup");
+	return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(Resolver_AddNameserverDoc,
+"addNameserver(self, address)\n\
+\n\
+Add a nameserver, given as an IP address string with an optional port\n\
+(e.g. '127.0.0.1:5353' or '[::1]:53').");
+static PyObject *Resolver_AddNameserver(ResolverObject *self, PyObject *args, 
+					PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"address", NULL};
+    char        *address = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s:addNameserver", kwlist,
+				     &address))
+	return NULL;
+    if (!__libevent_resolver_ready(self))
+	return NULL;
+    if (evdns_base_nameserver_ip_add(self->dns_base, address) != 0) { 
+	PyErr_SetString(EventErrorObject, "unable to add nameserver");
+	return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(Resolver_SetOptionDoc,
+"setOption(self, option, value)\n\
+\n\
+Set a resolv.conf-style option on the resolver, e.g.\n\
+setOption('timeout:', '1') or setOption('attempts:', '2').");
+static PyObject *Resolver_SetOption(ResolverObject *self, PyObject *args, 
+				    PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"option", "value", NULL};
+    char        *option = NULL;
+    char        *value = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss:setOption", kwlist,
+				     &option, &value))
+	return NULL;
+    if (!__libevent_resolver_ready(self))
+	return NULL;
+    if (evdns_base_set_option(self->dns_base, option, value) != 0) { 
+	PyErr_SetString(EventErrorObject, "unable to set resolver option");
+	return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(Resolver_ClearCacheDoc,
+"clearCache(self)\n\
+\n\
+Discard every cached answer, positive and negative.");
+static PyObject *Resolver_ClearCache(ResolverObject *self, PyObject *args, 
+				     PyObject *kwargs) 
+{ 
+    PyDict_Clear(self->cache);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+#define OFF(x) offsetof(ResolverObject, x)
+static PyMemberDef Resolver_Members[] = {
+    {"eventBase",   T_OBJECT, OFF(eventBase),     
+     RO, "The EventBase for this resolver"},
+    {"negativeTTL", T_DOUBLE, OFF(negativeTTL),  
+     0,  "Seconds to cache names that do not exist"},
+    {"maxTTL",      T_DOUBLE, OFF(maxTTL),  
+     0,  "Upper bound, in seconds, on how long an answer is cached"},
+    {"maxEntries",  T_INT,    OFF(maxEntries),  
+     0,  "Most answers kept in the cache; 0 disables caching"},
+    {"cacheHits",   T_LONG,   OFF(cacheHits),  
+     RO, "Number of lookups answered from the cache"},
+    {"cacheMisses", T_LONG,   OFF(cacheMisses),  
+     RO, "Number of lookups not answered from the cache"},
+    {"coalesced",   T_LONG,   OFF(coalesced),  
+     RO, "Number of lookups that joined a query already in flight"},
+    {NULL}
+};
+#undef OFF
+
+static PyObject *Resolver_GetCacheSize(ResolverObject *self, void *closure) {
+    return PyInt_FromSsize_t(PyDict_Size(self->cache));
+}
+
+static PyGetSetDef Resolver_Properties[] = {
+    {"cacheSize",   (getter)Resolver_GetCacheSize, NULL,
+     "Number of answers in the cache, including expired ones not yet evicted"},
+    {NULL},
+};
+
+static PyMethodDef Resolver_Methods[] = { 
+    {"resolve",                  (PyCFunction)Resolver_Resolve,      
+     METH_VARARGS|METH_KEYWORDS, Resolver_ResolveDoc},
+    {"addNameserver",            (PyCFunction)Resolver_AddNameserver,      
+     METH_VARARGS|METH_KEYWORDS, Resolver_AddNameserverDoc},
+    {"setOption",                (PyCFunction)Resolver_SetOption,      
+     METH_VARARGS|METH_KEYWORDS, Resolver_SetOptionDoc},
+    {"clearCache",               (PyCFunction)Resolver_ClearCache,      
+     METH_NOARGS,                Resolver_ClearCacheDoc},
+    {NULL},
+};
+
+static PyTypeObject Resolver_Type = {
+    PyObject_HEAD_INIT(&PyType_Type)
+    0,                      
+    "event.Resolver",                          /*tp_name*/
+    sizeof(ResolverObject),                    /*tp_basicsize*/
+    0,                                         /*tp_itemsize*/
+    /* methods */
+    (destructor)Resolver_Dealloc,              /*tp_dealloc*/
+    0,                                         /*tp_print*/
+    0,                                         /*tp_getattr*/
+    0,                                         /*tp_setattr*/
+    0,                                         /*tp_compare*/
+    0,                                         /*tp_repr*/
+    0,                                         /*tp_as_number*/
+    0,                                         /*tp_as_sequence*/
+    0,                                         /*tp_as_mapping*/
+    0,                                         /*tp_hash*/
+    0,                                         /*tp_call*/
+    0,                                         /*tp_str*/
+    PyObject_GenericGetAttr,                   /*tp_getattro*/
+    PyObject_GenericSetAttr,                   /*tp_setattro*/
+    0,                                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,  /*tp_flags*/
+    0,                                         /*tp_doc*/
+    0,                                         /*tp_traverse*/
+    0,                                         /*tp_clear*/
+    0,                                         /*tp_richcompare*/
+    0,                                         /*tp_weaklistoffset*/
+    0,                                         /*tp_iter*/
+    0,                                         /*tp_iternext*/
+    Resolver_Methods,                          /*tp_methods*/
+    Resolver_Members,                          /*tp_members*/
+    Resolver_Properties,                       /*tp_getset*/
+    0,                                         /*tp_base*/
+    0,                                         /*tp_dict*/
+    0,                                         /*tp_descr_get*/
+    0,                                         /*tp_descr_set*/
+    0,                                         /*tp_dictoffset*/
+    (initproc)Resolver_Init,                   /*tp_init*/
+    PyType_GenericAlloc,                       /*tp_alloc*/
+    Resolver_New,                              /*tp_new*/
+    PyObject_Del,                              /*tp_free*/
+    0,                                         /*tp_is_gc*/
+};
+
+
+/* 
+ * Build a token bucket config from Python-level arguments.  A rate of 0
+ * means unlimited, and a burst of 0 means the same as the rate.
+ */
+static struct ev_token_bucket_cfg *__libevent_bucket_cfg(Py_ssize_t readRate,
+							 Py_ssize_t readBurst,
+							 Py_ssize_t writeRate,
+							 Py_ssize_t writeBurst,
+							 double tick)
+{ 
+    struct ev_token_bucket_cfg *cfg;
+    struct timeval              tv;
+
+    if (readRate < 0 || readBurst < 0 || writeRate < 0 || writeBurst < 0 ||
+	tick <= 0.0) { 
+	PyErr_SetString(EventErrorObject, 
+			"rates and bursts must be >= 0, and tick must be > 0");
+	return NULL;
+    }
+    if (readRate == 0)
+	readRate = readBurst = EV_RATE_LIMIT_MAX;
+    else if (readBurst == 0)
+	readBurst = readRate;
+    if (writeRate == 0)
+	writeRate = writeBurst = EV_RATE_LIMIT_MAX;
+    else if (writeBurst == 0)
+	writeBurst = writeRate;
+
+    tv.tv_sec = (long) tick;
+    tv.tv_usec = (tick - (long) tick) * 1000000;
+    cfg = ev_token_bucket_cfg_new(readRate, readBurst, writeRate, writeBurst,
+				  &tv);
+    if (cfg == NULL)
+	PyErr_SetString(EventErrorObject, "invalid rate limit");
+    return cfg;
+}
+
+/* 
+ * Throttle accounting.  A connection is throttled from the moment its own
+ * bucket, or its group's shared bucket, runs dry while it has data waiting,
+ * until it next transfers, is disabled in that direction, or hits EOF or an
+ * error.  Each waiting byte is counted once, however many
+ * throttles it sits through.  Group counters are summed over members.
+ */
+static void __libevent_throttle_start(ThrottleStats *stats, 
+				      ThrottleStats *groupStats, 
+				      size_t pending, double now) 
+{ 
+    if (pending == 0)
+	return;
+    if (stats->since == 0)
+	stats->since = now;
+    if (pending > stats->counted) { 
+	stats->bytes += pending - stats->counted;
+	if (groupStats != NULL)
+	    groupStats->bytes += pending - stats->counted;
+	stats->counted = pending;
+    }
+}
+
+/* Fold the time spent throttled so far into the totals. */
+static void __libevent_throttle_settle(ThrottleStats *stats, 
+				       ThrottleStats *groupStats, double now) 
+{ 
+    if (stats->since == 0)
+	return;
+    stats->seconds += now - stats->since;
+    if (groupStats != NULL)
+	groupStats->seconds += now - stats->since;
+    stats->since = now;
+}
+
+/* A transfer of <n> bytes ends any throttle in progress. */
+static void __libevent_throttle_end(ThrottleStats *stats, 
+				    ThrottleStats *groupStats, size_t n, 
+				    double now) 
+{ 
+    __libevent_throttle_settle(stats, groupStats, now);
+    stats->since = 0;
+    stats->counted = n < stats->counted ? stats->counted - n : 0;
+}
+
+/* Seconds spent throttled, including any throttle still in progress. */
+static double __libevent_throttle_seconds(ThrottleStats *stats, double now) { 
+    if (stats->since > 0)
+	return stats->seconds + now - stats->since;
+    return stats->seconds;
+}
+
+/* Typechecker */
+int RateLimitGroup_Check(PyObject *o) { 
+    return ((o->ob_type) == &RateLimitGroup_Type);
+}
+
+/* Construct a new RateLimitGroupObject */
+static PyObject *RateLimitGroup_New(PyTypeObject *type, PyObject *args, 
+				    PyObject *kwargs) 
+{
+    RateLimitGroupObject *self = NULL;
+    assert(type != NULL && type->tp_alloc != NULL);
+    self = (RateLimitGroupObject *)type->tp_alloc(type, 0);
+    return (PyObject *)self;
+}
+
+/* RateLimitGroupObject initializer */
+static int RateLimitGroup_Init(RateLimitGroupObject *self, PyObject *args, 
+			       PyObject *kwargs) 
+{ 
+    static char                *kwlist[] = {"name", "eventBase", "readRate", 
+					    "readBurst", "writeRate", 
+					    "writeBurst", "tick", NULL};
+    PyObject                   *name = NULL;
+    PyObject                   *eventBase = NULL;
+    Py_ssize_t                  readRate = 0, readBurst = 0;
+    Py_ssize_t                  writeRate = 0, writeBurst = 0;
+    double                      tick = 1.0;
+    struct ev_token_bucket_cfg *cfg;
+    EventBaseObject            *base;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "S|Onnnnd:RateLimitGroup",
+				     kwlist, &name, &eventBase, &readRate, 
+				     &readBurst, &writeRate, &writeBurst, 
+				     &tick))
+	return -1;
+
+    if (self->cfg != NULL) { 
+	PyErr_SetString(EventErrorObject, 
+			"rate limit group is already initialized");
+	return -1;
+    }
+    if (eventBase == NULL || eventBase == Py_None)
+	eventBase = (PyObject *)defaultEventBase;
+    if (!EventBase_Check(eventBase)) { 
+	PyErr_SetString(EventErrorObject, "argument is not an EventBase object");
+	return -1;
+    }
+    base = (EventBaseObject *)eventBase;
+    if (PyDict_GetItem(base->rateLimitGroups, name) != NULL) { 
+	PyErr_Format(EventErrorObject, "rate limit group '%s' already exists",
+		     PyString_AS_STRING(name));
+	return -1;
+    }
+
+    cfg = __libevent_bucket_cfg(readRate, readBurst, writeRate, writeBurst, 
+				tick);
+    if (cfg == NULL)
+	return -1;
+    if (PyDict_SetItem(base->rateLimitGroups, name, (PyObject *)self) < 0) { 
+	ev_token_bucket_cfg_free(cfg);
+	return -1;
+    }
+
+    /* The libevent group is created when the first member joins. */
+    self->cfg = cfg;
+    self->minShare = -1;
+    Py_INCREF(name);
+    self->name = name;
+    Py_INCREF(eventBase);
+    self->eventBase = base;
+    return 0;
+}
+
+/* Raise EventError unless __init__ has set the group up. */
+static int __libevent_group_ready(RateLimitGroupObject *self) { 
+    if (self->cfg == NULL) { 
+	PyErr_SetString(EventErrorObject, 
+			"rate limit group is not initialized");
+	return 0;
+    }
+    return 1;
+}
+
+/* 
+ * Create the libevent group when the first member joins, and free it when
+ * the last one leaves, carrying its byte totals over.
+ */
+static int __libevent_group_open(RateLimitGroupObject *self) { 
+    if (self->group != NULL)
+	return 0;
+    self->group = bufferevent_rate_limit_group_new(self->eventBase->ev_base,
+						   self->cfg);
+    if (self->group == NULL) { 
+	PyErr_SetString(EventErrorObject, "unable to create rate limit group");
+	return -1;
+    }
+    if (self->minShare >= 0)
+	bufferevent_rate_limit_group_set_min_share(self->group, 
+						   self->minShare);
+    return 0;
+}
+
+static void __libevent_group_close(RateLimitGroupObject *self) { 
+    ev_uint64_t totalRead = 0, totalWritten = 0;
+
+    if (self->group == NULL || self->members != NULL)
+	return;
+    bufferevent_rate_limit_group_get_totals(self->group, &totalRead, 
+					    &totalWritten);
+    self->totalRead += totalRead;
+    self->totalWritten += totalWritten;
+    bufferevent_rate_limit_group_free(self->group);
+    self->group = NULL;
+}
+
+/* RateLimitGroupObject destructor */
+static void RateLimitGroup_Dealloc(RateLimitGroupObject *obj) { 
+    /* Members hold a reference, so the group is empty by now. */
+    if (obj->group != NULL)
+	bufferevent_rate_limit_group_free(obj->group);
+    if (obj->cfg != NULL)
+	ev_token_bucket_cfg_free(obj->cfg);
+    Py_XDECREF(obj->eventBase);
+    Py_XDECREF(obj->name);
+    obj->ob_type->tp_free((PyObject *)obj);
+}	
+
+PyDoc_STRVAR(RateLimitGroup_ConfigureDoc,
+"configure(self, readRate=0, readBurst=0, writeRate=0, writeBurst=0,\n\
+          tick=1.0)\n\
+\n\
+Replace the group's token bucket settings.  Rates are in bytes per <tick>\n\
+seconds; a rate of 0 means unlimited.");
+static PyObject *RateLimitGroup_Configure(RateLimitGroupObject *self, 
+					  PyObject *args, PyObject *kwargs) 
+{ 
+    static char                *kwlist[] = {"readRate", "readBurst", 
+					    "writeRate", "writeBurst", "tick",
+					    NULL};
+    Py_ssize_t                  readRate = 0, readBurst = 0;
+    Py_ssize_t                  writeRate = 0, writeBurst = 0;
+    double                      tick = 1.0;
+    struct ev_token_bucket_cfg *cfg;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|nnnnd:configure", kwlist,
+				     &readRate, &readBurst, &writeRate, 
+				     &writeBurst, &tick))
+	return NULL;
+    if (!__libevent_group_ready(self))
+	return NULL;
+
+    cfg = __libevent_bucket_cfg(readRate, readBurst, writeRate, writeBurst, 
+				tick);
+    if (cfg == NULL)
+	return NULL;
+    if (self->group != NULL && 
+	bufferevent_rate_limit_group_set_cfg(self->group, cfg) < 0) { 
+	ev_token_bucket_cfg_free(cfg);
+	PyErr_SetString(EventErrorObject, "unable to configure rate limit group");
+	return NULL;
+    }
+    ev_token_bucket_cfg_free(self->cfg);
+    self->cfg = cfg;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(RateLimitGroup_SetMinShareDoc,
+"setMinShare(self, bytes)\n\
+\n\
+Set the smallest number of bytes a member may transfer at once when the\n\
+group's bandwidth is split between its members.");
+static PyObject *RateLimitGroup_SetMinShare(RateLimitGroupObject *self, 
+					    PyObject *args, PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"bytes", NULL};
+    Py_ssize_t   share = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n:setMinShare", kwlist,
+				     &share))
+	return NULL;
+    if (!__libevent_group_ready(self))
+	return NULL;
+    if (share < 0 || (self->group != NULL &&
+	bufferevent_rate_limit_group_set_min_share(self->group, share) < 0)) { 
+	PyErr_SetString(EventErrorObject, "invalid minimum share");
+	return NULL;
+    }
+    self->minShare = share;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(RateLimitGroup_GetTotalsDoc,
+"getTotals(self) -> (bytesRead, bytesWritten)\n\
+\n\
+Return the total number of bytes read and written by members of the group.");
+static PyObject *RateLimitGroup_GetTotals(RateLimitGroupObject *self, 
+					  PyObject *args, PyObject *kwargs) 
+{ 
+    ev_uint64_t totalRead = 0, totalWritten = 0;
+
+    if (!__libevent_group_ready(self))
+	return NULL;
+    if (self->group != NULL)
+	bufferevent_rate_limit_group_get_totals(self->group, &totalRead, 
+						&totalWritten);
+    return Py_BuildValue("(KK)", 
+			 (unsigned PY_LONG_LONG) (self->totalRead + totalRead),
+			 (unsigned PY_LONG_LONG) (self->totalWritten + 
+						  totalWritten));
+}
+
+PyDoc_STRVAR(RateLimitGroup_ResetTotalsDoc,
+"resetTotals(self)\n\
+\n\
+Reset the byte totals and throttle counters for this group.");
+static PyObject *RateLimitGroup_ResetTotals(RateLimitGroupObject *self, 
+					    PyObject *args, PyObject *kwargs) 
+{ 
+    double             now;
+    BufferEventObject *m;
+
+    if (!__libevent_group_ready(self))
+	return NULL;
+    now = __libevent_base_now(self->eventBase);
+    if (self->group != NULL)
+	bufferevent_rate_limit_group_reset_totals(self->group);
+    self->totalRead = self->totalWritten = 0;
+    for (m = self->members; m != NULL; m = m->groupNext) { 
+	__libevent_throttle_settle(&m->reads, NULL, now);
+	__libevent_throttle_settle(&m->writes, NULL, now);
+    }
+    memset(&self->reads, 0, sizeof(self->reads));
+    memset(&self->writes, 0, sizeof(self->writes));
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+#define OFF(x) offsetof(RateLimitGroupObject, x)
+static PyMemberDef RateLimitGroup_Members[] = {
+    {"name",               T_OBJECT,   OFF(name),     
+     RO, "The name of this rate limit group"},
+    {"eventBase",          T_OBJECT,   OFF(eventBase),     
+     RO, "The EventBase for this rate limit group"},
+    {"readThrottledBytes", T_LONGLONG, OFF(reads.bytes),
+     RO, "Bytes members had to wait for read tokens to receive"},
+    {"writeThrottledBytes",T_LONGLONG, OFF(writes.bytes),
+     RO, "Bytes members had to wait for write tokens to send"},
+    {NULL}
+};
+#undef OFF
+
+/* Seconds members spent throttled, summed, including throttles in progress */
+static PyObject *__libevent_group_throttle_seconds(RateLimitGroupObject *self,
+						   int reading) 
+{ 
+    double             now, seconds;
+    BufferEventObject *m;
+
+    if (!__libevent_group_ready(self))
+	return NULL;
+    now = __libevent_base_now(self->eventBase);
+    seconds = reading ? self->reads.seconds : self->writes.seconds;
+    for (m = self->members; m != NULL; m = m->groupNext) { 
+	ThrottleStats *stats = reading ? &m->reads : &m->writes;
+	if (stats->since > 0)
+	    seconds += now - stats->since;
+    }
+    return PyFloat_FromDouble(seconds);
+}
+
+static PyObject *RateLimitGroup_GetReadThrottledTime(RateLimitGroupObject *self,
+						     void *closure) 
+{ 
+    return __libevent_group_throttle_seconds(self, 1);
+}
+
+static PyObject *RateLimitGroup_GetWriteThrottledTime(
+    RateLimitGroupObject *self, void *closure) 
+{ 
+    return __libevent_group_throttle_seconds(self, 0);
+}
+
+static PyGetSetDef RateLimitGroup_Properties[] = {
+    {"readThrottledTime",  (getter)RateLimitGroup_GetReadThrottledTime, NULL,
+     "Seconds members spent waiting for read tokens, summed"},
+    {"writeThrottledTime", (getter)RateLimitGroup_GetWriteThrottledTime, NULL,
+     "Seconds members spent waiting for write tokens, summed"},
+    {NULL},
+};
+
+static PyMethodDef RateLimitGroup_Methods[] = { 
+    {"configure",                (PyCFunction)RateLimitGroup_Configure,
+     METH_VARARGS|METH_KEYWORDS, RateLimitGroup_ConfigureDoc},
+    {"setMinShare",              (PyCFunction)RateLimitGroup_SetMinShare,
+     METH_VARARGS|METH_KEYWORDS, RateLimitGroup_SetMinShareDoc},
+    {"getTotals",                (PyCFunction)RateLimitGroup_GetTotals,
+     METH_NOARGS,                RateLimitGroup_GetTotalsDoc},
+    {"resetTotals",              (PyCFunction)RateLimitGroup_ResetTotals,
+     METH_NOARGS,                RateLimitGroup_ResetTotalsDoc},
+    {NULL},
+};
+
+static PyTypeObject RateLimitGroup_Type = {
+    PyObject_HEAD_INIT(&PyType_Type)
+    0,                      
+    "event.RateLimitGroup",                    /*tp_name*/
+    sizeof(RateLimitGroupObject),              /*tp_basicsize*/
+    0,                                         /*tp_itemsize*/
+    /* methods */
+    (destructor)RateLimitGroup_Dealloc,        /*tp_dealloc*/
+    0,                                         /*tp_print*/
+    0,                                         /*tp_getattr*/
+    0,                                         /*tp_setattr*/
+    0,                                         /*tp_compare*/
+    0,                                         /*tp_repr*/
+    0,                                         /*tp_as_number*/
+    0,                                         /*tp_as_sequence*/
+    0,                                         /*tp_as_mapping*/
+    0,                                         /*tp_hash*/
+    0,                                         /*tp_call*/
+    0,                                         /*tp_str*/
+    PyObject_GenericGetAttr,                   /*tp_getattro*/
+    PyObject_GenericSetAttr,                   /*tp_setattro*/
+    0,                                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,  /*tp_flags*/
+    0,                                         /*tp_doc*/
+    0,                                         /*tp_traverse*/
+    0,                                         /*tp_clear*/
+    0,                                         /*tp_richcompare*/
+    0,                                         /*tp_weaklistoffset*/
+    0,                                         /*tp_iter*/
+    0,                                         /*tp_iternext*/
+    RateLimitGroup_Methods,                    /*tp_methods*/
+    RateLimitGroup_Members,                    /*tp_members*/
+    RateLimitGroup_Properties,                 /*tp_getset*/
+    0,                                         /*tp_base*/
+    0,                                         /*tp_dict*/
+    0,                                         /*tp_descr_get*/
+    0,                                         /*tp_descr_set*/
+    0,                                         /*tp_dictoffset*/
+    (initproc)RateLimitGroup_Init,             /*tp_init*/
+    PyType_GenericAlloc,                       /*tp_alloc*/
+    RateLimitGroup_New,                        /*tp_new*/
+    PyObject_Del,                              /*tp_free*/
+    0,                                         /*tp_is_gc*/
+};
+
+
+/* Typechecker */
+int BufferEvent_Check(PyObject *o) { 
+    return ((o->ob_type) == &BufferEvent_Type);
+}
+
+/* Construct a new BufferEventObject */
+static PyObject *BufferEvent_New(PyTypeObject *type, PyObject *args, 
+				 PyObject *kwargs) 
+{
+    BufferEventObject *self = NULL;
+    assert(type != NULL && type->tp_alloc != NULL);
+    self = (BufferEventObject *)type->tp_alloc(type, 0);
+    return (PyObject *)self;
+}
+
+/* Raise EventError unless __init__ has set the buffer event up. */
+static int __libevent_bufferevent_ready(BufferEventObject *self) { 
+    if (self->bev == NULL) { 
+	PyErr_SetString(EventErrorObject, "buffer event is not initialized");
+	return 0;
+    }
+    return 1;
+}
+
+/* Invoke a BufferEvent callback, keeping the object alive across the call. */
+static void __libevent_bufferevent_call(BufferEventObject *self, 
+					PyObject *callback, PyObject *args) 
+{ 
+    PyObject *result;
+
+    if (args == NULL) { 
+	__libevent_report_error(self->eventBase);
+	return;
+    }
+    Py_INCREF(self);
+    result = PyObject_Call(callback, args, NULL);
+    if (result == NULL)
+	__libevent_report_error(self->eventBase);
+    Py_XDECREF(result);
+    __libevent_release_error_timer(self->eventBase);
+    Py_DECREF(args);
+    Py_DECREF(self);
+}
+
+static void __libevent_bufferevent_unthrottle(BufferEventObject *, int);
+
+/* bufferevent callback thunks */
+static void __libevent_bufferevent_readcb(struct bufferevent *bev, void *arg) {
+    BufferEventObject *self = arg;
+
+    if (self->readCallback != Py_None)
+	__libevent_bufferevent_call(self, self->readCallback, 
+				    Py_BuildValue("(O)", self));
+}
+
+static void __libevent_bufferevent_writecb(struct bufferevent *bev, void *arg){
+    BufferEventObject *self = arg;
+
+    if (self->writeCallback != Py_None)
+	__libevent_bufferevent_call(self, self->writeCallback, 
+				    Py_BuildValue("(O)", self));
+}
+
+static void __libevent_bufferevent_eventcb(struct bufferevent *bev, 
+					   short what, void *arg) 
+{
+    BufferEventObject *self = arg;
+
+    /* No more transfers in a direction that hit EOF or an error. */
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) { 
+	if (what & BEV_EVENT_READING)
+	    __libevent_bufferevent_unthrottle(self, 1);
+	if (what & BEV_EVENT_WRITING)
+	    __libevent_bufferevent_unthrottle(self, 0);
+    }
+    if (self->errorCallback != Py_None)
+	__libevent_bufferevent_call(self, self->errorCallback, 
+				    Py_BuildValue("(Oi)", self, what));
+}
+
+#define THROTTLE_STATS(bev, reading) \
+    ((reading) ? &(bev)->reads : &(bev)->writes)
+#define GROUP_THROTTLE_STATS(bev, reading) \
+    ((bev)->rateLimitGroup == NULL ? NULL : \
+     THROTTLE_STATS((bev)->rateLimitGroup, reading))
+
+/* Bytes a buffer event has waiting to be read or written. */
+static size_t __libevent_bufferevent_pending(BufferEventObject *self, 
+					     int reading) 
+{ 
+    int pending = 0;
+
+    if (!(bufferevent_get_enabled(self->bev) & (reading ? EV_READ : EV_WRITE)))
+	return 0;
+    if (!reading)
+	return evbuffer_get_length(bufferevent_get_output(self->bev));
+    if (ioctl(bufferevent_getfd(self->bev), FIONREAD, &pending) < 0)
+	return 0;
+    return pending > 0 ? pending : 0;
+}
+
+/* Tokens left in a buffer event's own bucket, and in its group's. */
+static ev_ssize_t __libevent_bufferevent_limit(BufferEventObject *self, 
+					       int reading) 
+{ 
+    return reading ? bufferevent_get_read_limit(self->bev) :
+		     bufferevent_get_write_limit(self->bev);
+}
+
+static ev_ssize_t __libevent_group_limit(BufferEventObject *self, int reading) {
+    if (self->rateLimitGroup == NULL)
+	return EV_RATE_LIMIT_MAX;
+    return reading ? 
+	bufferevent_rate_limit_group_get_read_limit(self->rateLimitGroup->group):
+	bufferevent_rate_limit_group_get_write_limit(self->rateLimitGroup->group);
+}
+
+/* 
+ * Account for <n> bytes moved by libevent, before they are charged to the
+ * buckets.  If they empty the connection's own bucket, it is throttled; if
+ * they empty the group's, libevent suspends every member, so every member
+ * with data waiting is throttled.
+ */
+static void __libevent_bufferevent_transfer(BufferEventObject *self, 
+					    int reading, size_t n) 
+{ 
+    double             now = __libevent_base_now(self->eventBase);
+    size_t             pending = __libevent_bufferevent_pending(self, reading);
+    ThrottleStats     *stats = THROTTLE_STATS(self, reading);
+    BufferEventObject *m;
+
+    __libevent_throttle_end(stats, GROUP_THROTTLE_STATS(self, reading), n, 
+			    now);
+    if (pending == 0)
+	stats->counted = 0;
+    if (__libevent_bufferevent_limit(self, reading) - (ev_ssize_t) n <= 0)
+	__libevent_throttle_start(stats, GROUP_THROTTLE_STATS(self, reading),
+				  pending, now);
+    if (__libevent_group_limit(self, reading) - (ev_ssize_t) n <= 0) { 
+	for (m = self->rateLimitGroup->members; m != NULL; m = m->groupNext)
+	    __libevent_throttle_start(THROTTLE_STATS(m, reading),
+				      GROUP_THROTTLE_STATS(m, reading),
+				      __libevent_bufferevent_pending(m, reading),
+				      now);
+    }
+}
+
+/* 
+ * evbuffer callbacks used for throttle accounting.  They run in C on every
+ * transfer, before libevent charges the bytes against the token buckets.
+ */
+static void __libevent_bufferevent_inputcb(struct evbuffer *buf, 
+					   const struct evbuffer_cb_info *info,
+					   void *arg) 
+{ 
+    if (info->n_added > 0)
+	__libevent_bufferevent_transfer(arg, 1, info->n_added);
+}
+
+static void __libevent_bufferevent_outputcb(struct evbuffer *buf, 
+					    const struct evbuffer_cb_info *info,
+					    void *arg) 
+{ 
+    BufferEventObject *self = arg;
+
+    if (info->n_deleted > 0)
+	__libevent_bufferevent_transfer(self, 0, info->n_deleted);
+    /* Data queued while a bucket is dry has to wait too. */
+    if (info->n_added > 0 && 
+	(__libevent_bufferevent_limit(self, 0) <= 0 || 
+	 __libevent_group_limit(self, 0) <= 0))
+	__libevent_throttle_start(&self->writes, GROUP_THROTTLE_STATS(self, 0),
+				  __libevent_bufferevent_pending(self, 0),
+				  __libevent_base_now(self->eventBase));
+}
+
+/* 
+ * End a throttle without a transfer, because the connection stopped
+ * reading or writing, or hit EOF or an error.  Bytes already counted stay
+ * counted, in case it picks up where it left off.
+ */
+static void __libevent_bufferevent_unthrottle(BufferEventObject *self, 
+					      int reading) 
+{ 
+    __libevent_throttle_end(THROTTLE_STATS(self, reading),
+			    GROUP_THROTTLE_STATS(self, reading), 0,
+			    __libevent_base_now(self->eventBase));
+}
+
+/* Add a buffer event to, or remove it from, its group's member list. */
+static void __libevent_bufferevent_join(BufferEventObject *self) { 
+    RateLimitGroupObject *group = self->rateLimitGroup;
+
+    self->groupPrev = NULL;
+    self->groupNext = group->members;
+    if (group->members != NULL)
+	group->members->groupPrev = self;
+    group->members = self;
+}
+
+static void __libevent_bufferevent_leave(BufferEventObject *self) { 
+    RateLimitGroupObject *group = self->rateLimitGroup;
+    double                now = __libevent_base_now(self->eventBase);
+
+    /* Time throttled so far belongs to the group being left. */
+    __libevent_throttle_settle(&self->reads, &group->reads, now);
+    __libevent_throttle_settle(&self->writes, &group->writes, now);
+    if (self->groupPrev != NULL)
+	self->groupPrev->groupNext = self->groupNext;
+    else
+	group->members = self->groupNext;
+    if (self->groupNext != NULL)
+	self->groupNext->groupPrev = self->groupPrev;
+    self->groupNext = self->groupPrev = NULL;
+}
+
+/* BufferEventObject initializer */
+static int BufferEvent_Init(BufferEventObject *self, PyObject *args, 
+			    PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"fd", "readCallback", "writeCallback", 
+			     "errorCallback", "eventBase", NULL};
+    PyObject    *fdObj = NULL;
+    PyObject    *readCallback = Py_None;
+    PyObject    *writeCallback = Py_None;
+    PyObject    *errorCallback = Py_None;
+    PyObject    *eventBase = NULL;
+    int          fd;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OOOO:BufferEvent", 
+				     kwlist, &fdObj, &readCallback, 
+				     &writeCallback, &errorCallback, 
+				     &eventBase))
+	return -1;
+
+    if (self->bev != NULL) { 
+	PyErr_SetString(EventErrorObject, "buffer event is already initialized");
+	return -1;
+    }
+    if ((readCallback != Py_None && !PyCallable_Check(readCallback)) ||
+	(writeCallback != Py_None && !PyCallable_Check(writeCallback)) ||
+	(errorCallback != Py_None && !PyCallable_Check(errorCallback))) {
+	PyErr_SetString(EventErrorObject,"callback argument must be callable");
+	return -1;
+    }
+    if (eventBase == NULL || eventBase == Py_None)
+	eventBase = (PyObject *)defaultEventBase;
+    if (!EventBase_Check(eventBase)) { 
+	PyErr_SetString(EventErrorObject, "argument is not an EventBase object");
+	return -1;
+    }
+    if ( (fd = PyObject_AsFileDescriptor(fdObj)) == -1 ) 
+	return -1;
+
+    self->bev = bufferevent_socket_new(((EventBaseObject *)eventBase)->ev_base,
+				       fd, 0);
+    if (self->bev == NULL) { 
+	PyErr_SetString(EventErrorObject, "unable to create buffer event");
+	return -1;
+    }
+    bufferevent_setcb(self->bev, __libevent_bufferevent_readcb,
+		      __libevent_bufferevent_writecb,
+		      __libevent_bufferevent_eventcb, self);
+    evbuffer_add_cb(bufferevent_get_input(self->bev), 
+		    __libevent_bufferevent_inputcb, self);
+    evbuffer_add_cb(bufferevent_get_output(self->bev), 
+		    __libevent_bufferevent_outputcb, self);
+    if (readCallback != Py_None)
+	bufferevent_enable(self->bev, EV_READ);
+
+    Py_INCREF(eventBase);
+    self->eventBase = (EventBaseObject *)eventBase;
+    Py_INCREF(readCallback);
+    self->readCallback = readCallback;
+    Py_INCREF(writeCallback);
+    self->writeCallback = writeCallback;
+    Py_INCREF(errorCallback);
+    self->errorCallback = errorCallback;
+    return 0;
+}
+
+/* BufferEventObject destructor */
+static void BufferEvent_Dealloc(BufferEventObject *obj) { 
+    if (obj->bev != NULL) { 
+	evbuffer_remove_cb(bufferevent_get_input(obj->bev), 
+			   __libevent_bufferevent_inputcb, obj);
+	evbuffer_remove_cb(bufferevent_get_output(obj->bev), 
+			   __libevent_bufferevent_outputcb, obj);
+	if (obj->rateLimitGroup != NULL) { 
+	    bufferevent_remove_from_rate_limit_group(obj->bev);
+	    __libevent_bufferevent_leave(obj);
+	    __libevent_group_close(obj->rateLimitGroup);
+	}
+	if (obj->rateLimit != NULL)
+	    bufferevent_set_rate_limit(obj->bev, NULL);
+	bufferevent_free(obj->bev);
+    }
+    if (obj->rateLimit != NULL)
+	ev_token_bucket_cfg_free(obj->rateLimit);
+    Py_XDECREF(obj->rateLimitGroup);
+    Py_XDECREF(obj->eventBase);
+    Py_XDECREF(obj->readCallback);
+    Py_XDECREF(obj->writeCallback);
+    Py_XDECREF(obj->errorCallback);
+    obj->ob_type->tp_free((PyObject *)obj);
+}	
+
+PyDoc_STRVAR(BufferEvent_WriteDoc,
+"write(self, data)\n\
+\n\
+Queue <data> to be written to the socket.");
+static PyObject *BufferEvent_Write(BufferEventObject *self, PyObject *args, 
+				   PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"data", NULL};
+    char        *data = NULL;
+    Py_ssize_t   len = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#:write", kwlist,
+				     &data, &len))
+	return NULL;
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+    if (bufferevent_write(self->bev, data, len) < 0) { 
+	PyErr_SetString(EventErrorObject, "unable to write to buffer event");
+	return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(BufferEvent_ReadDoc,
+"read(self, size=-1) -> string\n\
+\n\
+Remove and return up to <size> bytes from the input buffer, or all of it\n\
+if <size> is negative.");
+static PyObject *BufferEvent_Read(BufferEventObject *self, PyObject *args, 
+				  PyObject *kwargs) 
+{ 
+    static char     *kwlist[] = {"size", NULL};
+    Py_ssize_t       size = -1;
+    struct evbuffer *input;
+    PyObject        *data;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n:read", kwlist, &size))
+	return NULL;
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+    input = bufferevent_get_input(self->bev);
+    if (size < 0 || (size_t) size > evbuffer_get_length(input))
+	size = evbuffer_get_length(input);
+    data = PyString_FromStringAndSize(NULL, size);
+    if (data == NULL)
+	return NULL;
+    if (evbuffer_remove(input, PyString_AS_STRING(data), size) != size) { 
+	Py_DECREF(data);
+	PyErr_SetString(EventErrorObject, "unable to read from buffer event");
+	return NULL;
+    }
+    return data;
+}
+
+PyDoc_STRVAR(BufferEvent_EnableDoc,
+"enable(self, events)\n\
+\n\
+Start reading and/or writing; <events> is EV_READ, EV_WRITE or both.");
+static PyObject *BufferEvent_Enable(BufferEventObject *self, PyObject *args, 
+				    PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"events", NULL};
+    int          events = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i:enable", kwlist, 
+				     &events))
+	return NULL;
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+    if (bufferevent_enable(self->bev, events) < 0) { 
+	PyErr_SetString(EventErrorObject, "unable to enable buffer event");
+	return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(BufferEvent_DisableDoc,
+"disable(self, events)\n\
+\n\
+Stop reading and/or writing; <events> is EV_READ, EV_WRITE or both.");
+static PyObject *BufferEvent_Disable(BufferEventObject *self, PyObject *args, 
+				     PyObject *kwargs) 
+{ 
+    static char *kwlist[] = {"events", NULL};
+    int          events = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i:disable", kwlist, 
+				     &events))
+	return NULL;
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+    if (bufferevent_disable(self->bev, events) < 0) { 
+	PyErr_SetString(EventErrorObject, "unable to disable buffer event");
+	return NULL;
+    }
+    if (events & EV_READ)
+	__libevent_bufferevent_unthrottle(self, 1);
+    if (events & EV_WRITE)
+	__libevent_bufferevent_unthrottle(self, 0);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(BufferEvent_SetRateLimitDoc,
+"setRateLimit(self, readRate=0, readBurst=0, writeRate=0, writeBurst=0,\n\
+             tick=1.0)\n\
+\n\
+Limit this connection with its own token buckets.  Rates are in bytes per\n\
+<tick> seconds; a rate of 0 means unlimited, and a burst of 0 means the\n\
+same as the rate.  This applies in addition to any rate limit group.");
+static PyObject *BufferEvent_SetRateLimit(BufferEventObject *self, 
+					  PyObject *args, PyObject *kwargs) 
+{ 
+    static char                *kwlist[] = {"readRate", "readBurst", 
+					    "writeRate", "writeBurst", "tick",
+					    NULL};
+    Py_ssize_t                  readRate = 0, readBurst = 0;
+    Py_ssize_t                  writeRate = 0, writeBurst = 0;
+    double                      tick = 1.0;
+    struct ev_token_bucket_cfg *cfg;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|nnnnd:setRateLimit", 
+				     kwlist, &readRate, &readBurst, 
+				     &writeRate, &writeBurst, &tick))
+	return NULL;
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+
+    cfg = __libevent_bucket_cfg(readRate, readBurst, writeRate, writeBurst, 
+				tick);
+    if (cfg == NULL)
+	return NULL;
+    /* libevent holds on to the config, so the old one is freed after. */
+    if (bufferevent_set_rate_limit(self->bev, cfg) < 0) { 
+	ev_token_bucket_cfg_free(cfg);
+	PyErr_SetString(EventErrorObject, "unable to set rate limit");
+	return NULL;
+    }
+    if (self->rateLimit != NULL)
+	ev_token_bucket_cfg_free(self->rateLimit);
+    self->rateLimit = cfg;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(BufferEvent_ClearRateLimitDoc,
+"clearRateLimit(self)\n\
+\n\
+Remove this connection's own rate limit.  Group limits still apply.");
+static PyObject *BufferEvent_ClearRateLimit(BufferEventObject *self, 
+					    PyObject *args, PyObject *kwargs) 
+{ 
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+    if (self->rateLimit != NULL) { 
+	bufferevent_set_rate_limit(self->bev, NULL);
+	ev_token_bucket_cfg_free(self->rateLimit);
+	self->rateLimit = NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(BufferEvent_SetRateLimitGroupDoc,
+"setRateLimitGroup(self, group)\n\
+\n\
+Move this connection into <group>, given as a RateLimitGroup or the name of\n\
+one created on this connection's event base.  None leaves the current group.");
+static PyObject *BufferEvent_SetRateLimitGroup(BufferEventObject *self, 
+					       PyObject *args, 
+					       PyObject *kwargs) 
+{ 
+    static char          *kwlist[] = {"group", NULL};
+    PyObject             *group = NULL;
+    RateLimitGroupObject *old;
+    int                   rv;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O:setRateLimitGroup", 
+				     kwlist, &group))
+	return NULL;
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+
+    if (PyString_Check(group)) { 
+	PyObject *name = group;
+	group = PyDict_GetItem(self->eventBase->rateLimitGroups, name);
+	if (group == NULL) { 
+	    PyErr_Format(EventErrorObject, "no rate limit group named '%s'",
+			 PyString_AS_STRING(name));
+	    return NULL;
+	}
+    }
+    if (group != Py_None && !RateLimitGroup_Check(group)) { 
+	PyErr_SetString(EventErrorObject, 
+			"argument is not a RateLimitGroup object");
+	return NULL;
+    }
+    if (group != Py_None && 
+	!__libevent_group_ready((RateLimitGroupObject *)group))
+	return NULL;
+    if (group != Py_None && 
+	((RateLimitGroupObject *)group)->eventBase != self->eventBase) { 
+	PyErr_SetString(EventErrorObject, 
+			"rate limit group belongs to a different EventBase");
+	return NULL;
+    }
+
+    if (group == Py_None) 
+	rv = bufferevent_remove_from_rate_limit_group(self->bev);
+    else if (__libevent_group_open((RateLimitGroupObject *)group) < 0)
+	return NULL;
+    else
+	rv = bufferevent_add_to_rate_limit_group(
+	    self->bev, ((RateLimitGroupObject *)group)->group);
+    if (rv < 0) { 
+	if (group != Py_None)
+	    __libevent_group_close((RateLimitGroupObject *)group);
+	PyErr_SetString(EventErrorObject, "unable to set rate limit group");
+	return NULL;
+    }
+    old = self->rateLimitGroup;
+    if (old != NULL) { 
+	__libevent_bufferevent_leave(self);
+	self->rateLimitGroup = NULL;
+    }
+    if (group != Py_None) { 
+	Py_INCREF(group);
+	self->rateLimitGroup = (RateLimitGroupObject *)group;
+	__libevent_bufferevent_join(self);
+    }
+    /* Only once we've joined, in case the old group is the new one. */
+    if (old != NULL) { 
+	__libevent_group_close(old);
+	Py_DECREF(old);
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *BufferEvent_GetReadThrottledTime(BufferEventObject *self, 
+						  void *closure) 
+{ 
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+    return PyFloat_FromDouble(__libevent_throttle_seconds(
+				  &self->reads, __libevent_base_now(self->eventBase)));
+}
+
+static PyObject *BufferEvent_GetWriteThrottledTime(BufferEventObject *self, 
+						   void *closure) 
+{ 
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+    return PyFloat_FromDouble(__libevent_throttle_seconds(
+				  &self->writes, __libevent_base_now(self->eventBase)));
+}
+
+static PyObject *BufferEvent_GetInputLength(BufferEventObject *self, 
+					    void *closure) 
+{ 
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+    return PyInt_FromSsize_t(evbuffer_get_length(
+				 bufferevent_get_input(self->bev)));
+}
+
+static PyObject *BufferEvent_GetOutputLength(BufferEventObject *self, 
+					     void *closure) 
+{ 
+    if (!__libevent_bufferevent_ready(self))
+	return NULL;
+    return PyInt_FromSsize_t(evbuffer_get_length(
+				 bufferevent_get_output(self->bev)));
+}
+
+#define OFF(x) offsetof(BufferEventObject, x)
+static PyMemberDef BufferEvent_Members[] = {
+    {"eventBase",          T_OBJECT,   OFF(eventBase),     
+     RO, "The EventBase for this buffer event"},
+    {"rateLimitGroup",     T_OBJECT,   OFF(rateLimitGroup),     
+     RO, "The RateLimitGroup this buffer event belongs to, if any"},
+    {"readCallback",       T_OBJECT,   OFF(readCallback),     
+     RO, "Called with this buffer event when data has been read"},
+    {"writeCallback",      T_OBJECT,   OFF(writeCallback),     
+     RO, "Called with this buffer event when the output buffer drains"},
+    {"errorCallback",      T_OBJECT,   OFF(errorCallback),     
+     RO, "Called with (bufferEvent, BEV_EVENT_* flags) on EOF or error"},
+    {"readThrottledBytes", T_LONGLONG, OFF(reads.bytes),
+     RO, "Bytes that had to wait for read tokens to be received"},
+    {"writeThrottledBytes",T_LONGLONG, OFF(writes.bytes),
+     RO, "Bytes that had to wait for write tokens to be sent"},
+    {NULL}
+};
+#undef OFF
+
+static PyGetSetDef BufferEvent_Properties[] = {
+    {"readThrottledTime",  (getter)BufferEvent_GetReadThrottledTime, NULL,
+     "Seconds spent waiting for read tokens"},
+    {"writeThrottledTime", (getter)BufferEvent_GetWriteThrottledTime, NULL,
+     "Seconds spent waiting for write tokens"},
+    {"inputLength",        (getter)BufferEvent_GetInputLength, NULL,
+     "Number of bytes waiting in the input buffer"},
+    {"outputLength",       (getter)BufferEvent_GetOutputLength, NULL,
+     "Number of bytes waiting in the output buffer"},
+    {NULL},
+};
+
+static PyMethodDef BufferEvent_Methods[] = { 
+    {"write",                    (PyCFunction)BufferEvent_Write,
+     METH_VARARGS|METH_KEYWORDS, BufferEvent_WriteDoc},
+    {"read",                     (PyCFunction)BufferEvent_Read,
+     METH_VARARGS|METH_KEYWORDS, BufferEvent_ReadDoc},
+    {"enable",                   (PyCFunction)BufferEvent_Enable,
+     METH_VARARGS|METH_KEYWORDS, BufferEvent_EnableDoc},
+    {"disable",                  (PyCFunction)BufferEvent_Disable,
+     METH_VARARGS|METH_KEYWORDS, BufferEvent_DisableDoc},
+    {"setRateLimit",             (PyCFunction)BufferEvent_SetRateLimit,
+     METH_VARARGS|METH_KEYWORDS, BufferEvent_SetRateLimitDoc},
+    {"clearRateLimit",           (PyCFunction)BufferEvent_ClearRateLimit,
+     METH_NOARGS,                BufferEvent_ClearRateLimitDoc},
+    {"setRateLimitGroup",        (PyCFunction)BufferEvent_SetRateLimitGroup,
+     METH_VARARGS|METH_KEYWORDS, BufferEvent_SetRateLimitGroupDoc},
+    {NULL},
+};
+
+static PyTypeObject BufferEvent_Type = {
+    PyObject_HEAD_INIT(&PyType_Type)
+    0,                      
+    "event.BufferEvent",                       /*tp_name*/
+    sizeof(BufferEventObject),                 /*tp_basicsize*/
+    0,                                         /*tp_itemsize*/
+    /* methods */
+    (destructor)BufferEvent_Dealloc,           /*tp_dealloc*/
+    0,                                         /*tp_print*/
+    0,                                         /*tp_getattr*/
+    0,                                         /*tp_setattr*/
+    0,                                         /*tp_compare*/
+    0,                                         /*tp_repr*/
+    0,                                         /*tp_as_number*/
+    0,                                         /*tp_as_sequence*/
+    0,                                         /*tp_as_mapping*/
+    0,                                         /*tp_hash*/
+    0,                                         /*tp_call*/
+    0,                                         /*tp_str*/
+    PyObject_GenericGetAttr,                   /*tp_getattro*/
+    PyObject_GenericSetAttr,                   /*tp_setattro*/
+    0,                                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,  /*tp_flags*/
+    0,                                         /*tp_doc*/
+    0,                                         /*tp_traverse*/
+    0,                                         /*tp_clear*/
+    0,                                         /*tp_richcompare*/
+    0,                                         /*tp_weaklistoffset*/
+    0,                                         /*tp_iter*/
+    0,                                         /*tp_iternext*/
+    BufferEvent_Methods,                       /*tp_methods*/
+    BufferEvent_Members,                       /*tp_members*/
+    BufferEvent_Properties,                    /*tp_getset*/
+    0,                                         /*tp_base*/
+    0,                                         /*tp_dict*/
+    0,                                         /*tp_descr_get*/
+    0,                                         /*tp_descr_set*/
+    0,                                         /*tp_dictoffset*/
+    (initproc)BufferEvent_Init,                /*tp_init*/
+    PyType_GenericAlloc,                       /*tp_alloc*/
+    BufferEvent_New,                           /*tp_new*/
+    PyObject_Del,                              /*tp_free*/
+    0,                                         /*tp_is_gc*/
+};
+
+
+
+static PyObject *EventModule_setLogCallback(PyObject *self, PyObject *args, 
+					    PyObject *kwargs) { 
+    static char  *kwlist[] = {"callback", NULL};
+	
+    if (!PyArg_ParseTupleAndKeywords(args,kwargs,"O:setLogCallback", kwlist, 
+				     &logCallback))
+	return NULL;
+    
+    if (!PyCallable_Check(logCallback)) { 
+        PyErr_SetString(EventErrorObject, "log callback is not a callable");
+	logCallback = NULL;
+	return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyMethodDef EventModule_Functions[] = { 
+    {"setLogCallback", (PyCFunction)EventModule_setLogCallback, 
+     METH_VARARGS|METH_KEYWORDS},	
+    {NULL},
+};
+
+#define ADDCONST(mod, name, const)  PyModule_AddIntConstant(mod, name, const)
+DL_EXPORT(void) initevent(void)
+{
+    PyObject       *m, *d;
+	
+    m = Py_InitModule("event", EventModule_Functions);
+    d = PyModule_GetDict(m);
+
+    if (EventErrorObject == NULL) {
+	EventErrorObject = PyErr_NewException("libevent.EventError", 
+					      NULL, NULL);
+        if (EventErrorObject == NULL)
+            return;
+    }
+    Py_INCREF(EventErrorObject);
+    PyModule_AddObject(m, "EventError", EventErrorObject);
+
+    if (PyType_Ready(&EventBase_Type) < 0) { 
+	return;
+    }
+    PyModule_AddObject(m, "EventBase", (PyObject *)&EventBase_Type);
+    
+    if (PyType_Ready(&Event_Type) < 0)
+	return;
+    PyModule_AddObject(m, "Event", (PyObject *)&Event_Type);	
+
+    if (PyType_Ready(&Resolver_Type) < 0)
+	return;
+    PyModule_AddObject(m, "Resolver", (PyObject *)&Resolver_Type);
+
+    if (PyType_Ready(&RateLimitGroup_Type) < 0)
+	return;
+    PyModule_AddObject(m, "RateLimitGroup", (PyObject *)&RateLimitGroup_Type);
+
+    if (PyType_Ready(&BufferEvent_Type) < 0)
+	return;
+    PyModule_AddObject(m, "BufferEvent", (PyObject *)&BufferEvent_Type);
     
     defaultEventBase = (EventBaseObject *)EventBase_New(&EventBase_Type, 
 							NULL, NULL);
@@ -699,6 +2913,24 @@ DL_EXPORT(void) initevent(void)
     ADDCONST(m, "EV_PERSIST", EV_PERSIST);
     ADDCONST(m, "EVLOOP_ONCE", EVLOOP_ONCE);
     ADDCONST(m, "EVLOOP_NONBLOCK", EVLOOP_NONBLOCK);
+    ADDCONST(m, "BEV_EVENT_READING", BEV_EVENT_READING);
+    ADDCONST(m, "BEV_EVENT_WRITING", BEV_EVENT_WRITING);
+    ADDCONST(m, "BEV_EVENT_EOF", BEV_EVENT_EOF);
+    ADDCONST(m, "BEV_EVENT_ERROR", BEV_EVENT_ERROR);
+    ADDCONST(m, "BEV_EVENT_TIMEOUT", BEV_EVENT_TIMEOUT);
+    ADDCONST(m, "BEV_EVENT_CONNECTED", BEV_EVENT_CONNECTED);
+    ADDCONST(m, "DNS_ERR_NONE", DNS_ERR_NONE);
+    ADDCONST(m, "DNS_ERR_FORMAT", DNS_ERR_FORMAT);
+    ADDCONST(m, "DNS_ERR_SERVERFAILED", DNS_ERR_SERVERFAILED);
+    ADDCONST(m, "DNS_ERR_NOTEXIST", DNS_ERR_NOTEXIST);
+    ADDCONST(m, "DNS_ERR_NOTIMPL", DNS_ERR_NOTIMPL);
+    ADDCONST(m, "DNS_ERR_REFUSED", DNS_ERR_REFUSED);
+    ADDCONST(m, "DNS_ERR_TRUNCATED", DNS_ERR_TRUNCATED);
+    ADDCONST(m, "DNS_ERR_UNKNOWN", DNS_ERR_UNKNOWN);
+    ADDCONST(m, "DNS_ERR_TIMEOUT", DNS_ERR_TIMEOUT);
+    ADDCONST(m, "DNS_ERR_SHUTDOWN", DNS_ERR_SHUTDOWN);
+    ADDCONST(m, "DNS_ERR_CANCEL", DNS_ERR_CANCEL);
+    ADDCONST(m, "DNS_ERR_NODATA", DNS_ERR_NODATA);
     PyModule_AddObject(m, "LIBEVENT_VERSION", 
 		       PyString_FromString(event_get_version()));
     PyModule_AddObject(m, "LIBEVENT_METHOD",
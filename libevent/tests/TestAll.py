@@ -7,6 +7,8 @@ import unittest
 from TestEvent import *
 from TestEventBase import *
 from TestPackage import *
+from TestResolver import *
+from TestBufferEvent import *
 
 if __name__=='__main__':
     unittest.main()
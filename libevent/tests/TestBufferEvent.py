@@ -0,0 +1,277 @@
+import unittest
+import socket
+import sys
+import time
+import libevent
+
+__all__ = ["BufferEventTests", "RateLimitTests"]
+
+def passThroughCallback(*args):
+    return args
+
+class BufferEventTests(unittest.TestCase):
+    def setUp(self):
+        self.eventBase = libevent.EventBase()
+        self.a, self.b = socket.socketpair()
+
+    def tearDown(self):
+        self.a.close()
+        self.b.close()
+
+    def testValidConstruction(self):
+        bev = self.eventBase.createBufferEvent(self.a, passThroughCallback)
+        self.assertEqual(bev.eventBase, self.eventBase)
+        self.assertEqual(bev.readCallback, passThroughCallback)
+        self.assertEqual(bev.rateLimitGroup, None)
+
+    def testInvalidConstructionNonCallableCallback(self):
+        self.assertRaises(libevent.EventError, libevent.BufferEvent, self.a,
+                          "i'm not a callable")
+
+    def testReadCallback(self):
+        received = []
+        def gotData(bev):
+            received.append(bev.read())
+            self.eventBase.loopExit(0)
+        bev = self.eventBase.createBufferEvent(self.a, gotData)
+        self.b.send("foo")
+        self.eventBase.loopExit(5)
+        self.eventBase.dispatch()
+        self.assertEqual(received, ["foo"])
+
+    def testWrite(self):
+        bev = self.eventBase.createBufferEvent(
+            self.a, writeCallback=lambda bev: self.eventBase.loopExit(0))
+        bev.write("foo")
+        self.assertEqual(bev.outputLength, 3)
+        self.eventBase.loopExit(5)
+        self.eventBase.dispatch()
+        self.assertEqual(bev.outputLength, 0)
+        self.assertEqual(self.b.recv(3), "foo")
+
+    def testUninitializedBufferEvent(self):
+        bev = libevent.BufferEvent.__new__(libevent.BufferEvent)
+        self.assertRaises(libevent.EventError, bev.write, "foo")
+        self.assertRaises(libevent.EventError, bev.read)
+        self.assertRaises(libevent.EventError, bev.disable, libevent.EV_READ)
+        self.assertRaises(libevent.EventError, bev.clearRateLimit)
+        self.assertRaises(libevent.EventError, getattr, bev, "inputLength")
+        self.assertRaises(libevent.EventError, getattr, bev, 
+                          "readThrottledTime")
+
+    def testErrorCallbackOnEOF(self):
+        errors = []
+        def gotError(bev, what):
+            errors.append(what)
+            self.eventBase.loopExit(0)
+        bev = self.eventBase.createBufferEvent(self.a, passThroughCallback,
+                                               errorCallback=gotError)
+        self.b.close()
+        self.eventBase.loopExit(5)
+        self.eventBase.dispatch()
+        self.assertEqual(errors[0] & libevent.BEV_EVENT_EOF, 
+                         libevent.BEV_EVENT_EOF)
+
+class RateLimitTests(unittest.TestCase):
+    def setUp(self):
+        self.eventBase = libevent.EventBase()
+        self.a, self.b = socket.socketpair()
+        self.c, self.d = socket.socketpair()
+        self.writers = []
+        self.drainedAt = {}
+
+    def tearDown(self):
+        for s in (self.a, self.b, self.c, self.d):
+            s.close()
+
+    def gotDrained(self, bev):
+        index = self.writers.index(bev)
+        self.drainedAt.setdefault(index, time.time() - self.start)
+        if len(self.drainedAt) == len(self.writers):
+            self.eventBase.loopExit(0)
+
+    def writeAll(self, *bevs):
+        self.writers = list(bevs)
+        self.start = time.time()
+        for bev in bevs:
+            bev.write("x" * 2500)
+        self.eventBase.loopExit(5)
+        self.eventBase.dispatch()
+        return time.time() - self.start
+
+    def testConnectionRateLimit(self):
+        bev = self.eventBase.createBufferEvent(
+            self.a, writeCallback=self.gotDrained)
+        bev.setRateLimit(writeRate=1000, tick=0.1)
+        elapsed = self.writeAll(bev)
+        self.assertEqual(len(self.drainedAt), 1)
+        self.assert_(elapsed >= 0.15, elapsed)
+        self.assertEqual(bev.writeThrottledBytes, 1500)
+        self.assert_(bev.writeThrottledTime >= 0.15)
+        self.assertEqual(bev.readThrottledBytes, 0)
+
+    def testConnectionReadRateLimit(self):
+        received = []
+        def gotData(bev):
+            received.append(bev.read())
+            if len("".join(received)) == 2500:
+                self.eventBase.loopExit(0)
+        bev = self.eventBase.createBufferEvent(self.a, gotData)
+        bev.setRateLimit(readRate=1000, tick=0.1)
+        self.b.send("x" * 2500)
+        self.eventBase.loopExit(5)
+        self.eventBase.dispatch()
+        self.assertEqual(len("".join(received)), 2500)
+        self.assertEqual(bev.readThrottledBytes, 1500)
+        self.assert_(bev.readThrottledTime >= 0.15)
+
+    def testDisableStopsThrottleClock(self):
+        group = self.eventBase.createRateLimitGroup("bulk", writeRate=1000)
+        def gotData(bev):
+            bev.read()
+            bev.disable(libevent.EV_READ)
+            self.eventBase.loopExit(0)
+        bev = self.eventBase.createBufferEvent(self.a, gotData)
+        bev.setRateLimitGroup(group)
+        bev.setRateLimit(readRate=1000, tick=0.1)
+        self.b.send("x" * 2500)
+        self.eventBase.loopExit(5)
+        self.eventBase.dispatch()
+        self.assertEqual(bev.readThrottledBytes, 1500)
+        throttled = bev.readThrottledTime, group.readThrottledTime
+        # Nothing is read while disabled, so the clock must not run.
+        self.eventBase.loopExit(0.3)
+        self.eventBase.dispatch()
+        self.assertEqual((bev.readThrottledTime, group.readThrottledTime),
+                         throttled)
+        self.assertEqual(bev.readThrottledBytes, 1500)
+
+    def testClearRateLimit(self):
+        bev = self.eventBase.createBufferEvent(
+            self.a, writeCallback=self.gotDrained)
+        bev.setRateLimit(writeRate=1000, tick=0.1)
+        bev.clearRateLimit()
+        self.assert_(self.writeAll(bev) < 0.1)
+        self.assertEqual(bev.writeThrottledBytes, 0)
+
+    def testGroupRateLimit(self):
+        group = self.eventBase.createRateLimitGroup("bulk", writeRate=1000, 
+                                                    tick=0.1)
+        self.assertEqual(self.eventBase.rateLimitGroups["bulk"], group)
+        bev1 = self.eventBase.createBufferEvent(
+            self.a, writeCallback=self.gotDrained)
+        bev2 = self.eventBase.createBufferEvent(
+            self.c, writeCallback=self.gotDrained)
+        bev1.setRateLimitGroup(group)
+        bev2.setRateLimitGroup("bulk")
+        self.assertEqual(bev2.rateLimitGroup, group)
+        elapsed = self.writeAll(bev1, bev2)
+        self.assertEqual(len(self.drainedAt), 2)
+        self.assert_(elapsed >= 0.35, elapsed)
+        self.assertEqual(group.getTotals(), (0, 5000))
+        # Both members are suspended together whenever the group runs dry,
+        # so each is throttled until it drains, not just the one that
+        # emptied the bucket.
+        for i, bev in enumerate((bev1, bev2)):
+            self.assert_(bev.writeThrottledTime >= self.drainedAt[i] - 0.05,
+                         (bev.writeThrottledTime, self.drainedAt[i]))
+        self.assertAlmostEqual(group.writeThrottledTime, 
+                               bev1.writeThrottledTime + 
+                               bev2.writeThrottledTime, 6)
+        # Everything past the group's first burst (plus libevent's minimum
+        # per-member share of 64 bytes) had to wait.
+        self.assertEqual(group.writeThrottledBytes, 
+                         bev1.writeThrottledBytes + bev2.writeThrottledBytes)
+        self.assert_(group.writeThrottledBytes >= 5000 - 1000 - 64,
+                     group.writeThrottledBytes)
+        group.resetTotals()
+        self.assertEqual(group.getTotals(), (0, 0))
+        self.assertEqual(group.writeThrottledBytes, 0)
+
+    def testLeavingGroup(self):
+        group = self.eventBase.createRateLimitGroup("bulk", writeRate=1000, 
+                                                    tick=0.1)
+        bev = self.eventBase.createBufferEvent(
+            self.a, writeCallback=self.gotDrained)
+        bev.setRateLimitGroup(group)
+        bev.setRateLimitGroup(None)
+        self.assertEqual(bev.rateLimitGroup, None)
+        self.assert_(self.writeAll(bev) < 0.1)
+
+    def testRemoveGroup(self):
+        before = sys.getrefcount(self.eventBase)
+        group = self.eventBase.createRateLimitGroup("bulk", writeRate=1000)
+        bev = self.eventBase.createBufferEvent(self.a)
+        bev.setRateLimitGroup(group)
+        self.eventBase.removeRateLimitGroup("bulk")
+        self.assertEqual(self.eventBase.rateLimitGroups, {})
+        self.assertRaises(libevent.EventError, bev.setRateLimitGroup, "bulk")
+        # The name is free again while the old group still has a member.
+        other = self.eventBase.createRateLimitGroup("bulk", writeRate=1000)
+        self.eventBase.removeRateLimitGroup("bulk")
+        del other
+        del group
+        self.assertEqual(sys.getrefcount(self.eventBase), before + 2)
+        bev.setRateLimitGroup(None)
+        self.assertEqual(sys.getrefcount(self.eventBase), before + 1)
+        del bev
+        self.assertEqual(sys.getrefcount(self.eventBase), before)
+
+    def testRemoveUnknownGroup(self):
+        self.assertRaises(libevent.EventError, 
+                          self.eventBase.removeRateLimitGroup, "nope")
+
+    def testEmptyGroupDoesNotKeepLoopRunning(self):
+        group = self.eventBase.createRateLimitGroup("bulk", writeRate=1000, 
+                                                    tick=0.1)
+        bev = self.eventBase.createBufferEvent(self.a)
+        bev.disable(libevent.EV_READ)
+        bev.setRateLimitGroup(group)
+        bev.setRateLimitGroup(None)
+        # Nothing else is pending, so this only returns if the group's
+        # refill timer is gone.
+        start = time.time()
+        self.eventBase.dispatch()
+        self.assert_(time.time() - start < 0.5)
+
+    def testGroupOutlivesIdlePeriods(self):
+        group = self.eventBase.createRateLimitGroup("bulk", writeRate=1000, 
+                                                    tick=0.1)
+        bev = self.eventBase.createBufferEvent(
+            self.a, writeCallback=self.gotDrained)
+        bev.setRateLimitGroup(group)
+        self.writeAll(bev)
+        bev.setRateLimitGroup(None)
+        # Totals survive the group going idle, and settings carry over.
+        self.assertEqual(group.getTotals(), (0, 2500))
+        group.setMinShare(128)
+        bev.setRateLimitGroup(group)
+        self.drainedAt = {}
+        self.assert_(self.writeAll(bev) >= 0.15)
+        self.assertEqual(group.getTotals(), (0, 5000))
+
+    def testUninitializedGroup(self):
+        group = libevent.RateLimitGroup.__new__(libevent.RateLimitGroup)
+        self.assertRaises(libevent.EventError, group.getTotals)
+        self.assertRaises(libevent.EventError, group.configure, writeRate=1)
+        self.assertRaises(libevent.EventError, getattr, group, 
+                          "readThrottledTime")
+        bev = self.eventBase.createBufferEvent(self.a)
+        self.assertRaises(libevent.EventError, bev.setRateLimitGroup, group)
+
+    def testDuplicateGroupName(self):
+        self.eventBase.createRateLimitGroup("bulk", writeRate=1000)
+        self.assertRaises(libevent.EventError, 
+                          self.eventBase.createRateLimitGroup, "bulk")
+
+    def testUnknownGroupName(self):
+        bev = self.eventBase.createBufferEvent(self.a)
+        self.assertRaises(libevent.EventError, bev.setRateLimitGroup, "nope")
+
+    def testInvalidRate(self):
+        bev = self.eventBase.createBufferEvent(self.a)
+        self.assertRaises(libevent.EventError, bev.setRateLimit, 
+                          writeRate=-1)
+
+if __name__=='__main__':
+    unittest.main()
@@ -1,7 +1,9 @@
 import unittest
+import sys
+import time
 import libevent
 
-__all__ = ["EventBaseTests"]
+__all__ = ["EventBaseTests", "ErrorPolicyTests"]
 
 class EventBaseTests(unittest.TestCase):
     def testEventBaseValidConstructionNoArgs(self):
@@ -16,5 +18,123 @@ class EventBaseTests(unittest.TestCase):
     def testEventBaseInvalidConstruction(self):
         self.assertRaises(TypeError, libevent.EventBase, stupid=1)
 
+def raiseValueError(fd, events, eventObj):
+    raise ValueError("boom")
+
+def raiseKeyError(fd, events, eventObj):
+    raise KeyError("boom")
+
+class ErrorPolicyTests(unittest.TestCase):
+    def setUp(self):
+        self.eventBase = libevent.EventBase()
+        self.batches = []
+
+    def gotErrors(self, errors):
+        self.batches.append(errors)
+
+    def addTimers(self, *callbacks):
+        for cb in callbacks:
+            self.eventBase.createTimer(cb).addToLoop(0)
+
+    def testRepeatedErrorsAreAggregated(self):
+        self.eventBase.setErrorHandler(self.gotErrors, interval=0.05)
+        self.addTimers(*[raiseValueError] * 5)
+        self.eventBase.dispatch()
+        self.assertEqual(len(self.batches), 1)
+        self.assertEqual(len(self.batches[0]), 1)
+        count, type, value, tb = self.batches[0][0]
+        self.assertEqual(count, 5)
+        self.assertEqual(type, ValueError)
+        self.assertEqual(str(value), "boom")
+        self.assertEqual(self.eventBase.errorCount, 5)
+
+    def testDistinctErrorsAreKeptApart(self):
+        self.eventBase.setErrorHandler(self.gotErrors, interval=0.05)
+        self.addTimers(raiseValueError, raiseKeyError, raiseValueError)
+        self.eventBase.dispatch()
+        self.assertEqual(len(self.batches), 1)
+        counts = dict([(type, count) for count, type, value, tb 
+                       in self.batches[0]])
+        self.assertEqual(counts, {ValueError: 2, KeyError: 1})
+
+    def testBatchLimit(self):
+        self.eventBase.setErrorHandler(self.gotErrors, interval=0.05,
+                                       batchLimit=1)
+        self.addTimers(raiseValueError, raiseKeyError)
+        self.eventBase.dispatch()
+        self.assertEqual(len(self.batches[0]), 1)
+        self.assertEqual(self.eventBase.droppedErrors, 1)
+
+    def testFlushErrors(self):
+        self.eventBase.setErrorHandler(self.gotErrors, interval=60)
+        self.addTimers(raiseValueError)
+        # Something still pending, so loop() leaves the errors queued.
+        pending = self.eventBase.createTimer(lambda *args: None)
+        pending.addToLoop(60)
+        self.eventBase.loop(libevent.EVLOOP_ONCE)
+        self.assertEqual(self.batches, [])
+        self.eventBase.flushErrors()
+        self.assertEqual(len(self.batches), 1)
+
+    def testDispatchReturnsPromptly(self):
+        self.eventBase.setErrorHandler(self.gotErrors, interval=5)
+        self.addTimers(raiseValueError)
+        start = time.time()
+        self.eventBase.dispatch()
+        self.assert_(time.time() - start < 0.5)
+        self.assertEqual(len(self.batches), 1)
+
+    def testDispatchReturnsWhenLastEventFires(self):
+        fired = []
+        self.eventBase.setErrorHandler(self.gotErrors, interval=5)
+        self.addTimers(raiseValueError)
+        self.eventBase.createTimer(lambda *args: fired.append(1)).addToLoop(0.1)
+        start = time.time()
+        self.eventBase.dispatch()
+        self.assert_(time.time() - start < 0.5)
+        self.assertEqual(fired, [1])
+        self.assertEqual(len(self.batches), 1)
+
+    def testLoopFlushesWhenIdle(self):
+        self.eventBase.setErrorHandler(self.gotErrors, interval=5)
+        self.addTimers(raiseValueError)
+        self.eventBase.loop(libevent.EVLOOP_ONCE)
+        self.assertEqual(len(self.batches), 1)
+
+    def testStopOnError(self):
+        fired = []
+        self.eventBase.setErrorHandler(self.gotErrors, stopOnError=True)
+        self.eventBase.createTimer(raiseValueError).addToLoop(0)
+        self.eventBase.createTimer(lambda *args: fired.append(1)).addToLoop(1)
+        self.assertRaises(ValueError, self.eventBase.dispatch)
+        self.assertEqual(fired, [])
+
+    def testSystemExitPropagates(self):
+        fired = []
+        def exit(*args):
+            sys.exit(3)
+        self.eventBase.setErrorHandler(self.gotErrors)
+        self.eventBase.createTimer(exit).addToLoop(0)
+        self.eventBase.createTimer(lambda *args: fired.append(1)).addToLoop(0.1)
+        try:
+            self.eventBase.dispatch()
+        except SystemExit, e:
+            self.assertEqual(e.code, 3)
+        else:
+            self.fail("SystemExit was swallowed")
+        self.assertEqual(fired, [])
+        self.assertEqual(self.batches, [])
+
+    def testFailingHandlerDoesNotEscape(self):
+        def badHandler(errors):
+            raise RuntimeError("handler is broken")
+        self.eventBase.setErrorHandler(badHandler, interval=0.05)
+        self.addTimers(raiseValueError)
+        self.eventBase.dispatch()
+
+    def testInvalidNonCallableHandler(self):
+        self.assertRaises(libevent.EventError, self.eventBase.setErrorHandler,
+                          "i'm not a callable")
+
 if __name__=='__main__':
     unittest.main()
@@ -0,0 +1,216 @@
+import unittest
+import socket
+import struct
+import libevent
+
+__all__ = ["ResolverTests"]
+
+class StandInNameserver(object):
+    """
+    A minimal UDP nameserver on loopback, driven by the same event loop as
+    the resolver under test.  Answers A queries for names in <records> and
+    returns NXDOMAIN for everything else.
+    """
+    def __init__(self, eventBase, records, ttl=60):
+        self.records = records
+        self.ttl = ttl
+        self.queries = []
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(("127.0.0.1", 0))
+        self.address = "127.0.0.1:%d" % self.sock.getsockname()[1]
+        self.event = eventBase.createEvent(
+            self.sock, libevent.EV_READ|libevent.EV_PERSIST, self._gotQuery)
+        self.event.addToLoop()
+
+    def _gotQuery(self, fd, events, eventObj):
+        data, addr = self.sock.recvfrom(512)
+        qid = struct.unpack("!H", data[:2])[0]
+        labels, pos = [], 12
+        while ord(data[pos]):
+            length = ord(data[pos])
+            labels.append(data[pos+1:pos+1+length])
+            pos += length + 1
+        question = data[12:pos+5]
+        name = ".".join(labels).lower()
+        self.queries.append(name)
+        if name in self.records:
+            answer = struct.pack("!HHHIH", 0xc00c, 1, 1, self.ttl, 4)
+            answer += socket.inet_aton(self.records[name])
+            header = struct.pack("!HHHHHH", qid, 0x8180, 1, 1, 0, 0)
+        else:
+            answer = ""
+            header = struct.pack("!HHHHHH", qid, 0x8183, 1, 0, 0, 0)
+        self.sock.sendto(header + question + answer, addr)
+
+    def close(self):
+        self.event.removeFromLoop()
+        self.sock.close()
+
+class ResolverTests(unittest.TestCase):
+    def setUp(self):
+        self.eventBase = libevent.EventBase()
+        self.server = StandInNameserver(self.eventBase,
+                                        {"www.example.com": "10.0.0.1",
+                                         "a.example.com": "10.0.0.2",
+                                         "b.example.com": "10.0.0.3"})
+        self.resolver = self.eventBase.createResolver(initialize=False)
+        self.resolver.addNameserver(self.server.address)
+        self.results = []
+
+    def tearDown(self):
+        self.server.close()
+
+    def gotAnswer(self, hostname, result, addresses):
+        self.results.append((hostname, result, addresses))
+        self.eventBase.loopExit(0)
+
+    def run_(self):
+        self.eventBase.loopExit(5)
+        self.eventBase.dispatch()
+
+    def testResolverConstruction(self):
+        resolver = libevent.Resolver(initialize=False)
+        self.assertEqual(resolver.eventBase, libevent.DefaultEventBase)
+
+    def testResolve(self):
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.assertEqual(self.results, 
+                         [("www.example.com", libevent.DNS_ERR_NONE, 
+                           ["10.0.0.1"])])
+
+    def testCachedAnswerSkipsNameserver(self):
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.assertEqual(len(self.results), 1)
+        self.run_()
+        self.assertEqual(len(self.results), 2)
+        self.assertEqual(self.results[0], self.results[1])
+        self.assertEqual(self.server.queries, ["www.example.com"])
+        self.assertEqual(self.resolver.cacheHits, 1)
+        self.assertEqual(self.resolver.cacheMisses, 1)
+
+    def testConcurrentLookupsAreCoalesced(self):
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.assertEqual(len(self.results), 2)
+        self.assertEqual(self.server.queries, ["www.example.com"])
+        self.assertEqual(self.resolver.coalesced, 1)
+
+    def testCallbacksCannotAlterCache(self):
+        def popAnswer(hostname, result, addresses):
+            addresses.pop()
+            self.gotAnswer(hostname, result, addresses)
+        self.resolver.resolve("www.example.com", popAnswer)
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.resolver.resolve("www.example.com", popAnswer)
+        self.run_()
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.assertEqual([r[2] for r in self.results], 
+                         [[], ["10.0.0.1"], [], ["10.0.0.1"]])
+        self.assertEqual(self.server.queries, ["www.example.com"])
+
+    def testNamesAreCaseInsensitive(self):
+        self.resolver.resolve("WWW.Example.com", self.gotAnswer)
+        self.resolver.resolve("www.example.COM", self.gotAnswer)
+        self.run_()
+        self.resolver.resolve("www.EXAMPLE.com", self.gotAnswer)
+        self.run_()
+        self.assertEqual([r[0] for r in self.results], 
+                         ["WWW.Example.com", "www.example.COM", 
+                          "www.EXAMPLE.com"])
+        self.assertEqual(self.server.queries, ["www.example.com"])
+        self.assertEqual(self.resolver.coalesced, 1)
+        self.assertEqual(self.resolver.cacheHits, 1)
+
+    def testTrailingDotIsAbsolute(self):
+        # 'www.example.com' could be expanded with the search domains, so it
+        # doesn't share a cache entry with the absolute name.
+        self.resolver.resolve("www.example.com.", self.gotAnswer)
+        self.run_()
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.resolver.resolve("WWW.example.com.", self.gotAnswer)
+        self.run_()
+        self.assertEqual([r[2] for r in self.results], [["10.0.0.1"]] * 3)
+        self.assertEqual(self.server.queries, ["www.example.com"] * 2)
+        self.assertEqual(self.resolver.cacheHits, 1)
+        self.assertEqual(self.resolver.cacheSize, 2)
+
+    def testNegativeCaching(self):
+        self.resolver.resolve("nowhere.example.com", self.gotAnswer)
+        self.run_()
+        self.resolver.resolve("nowhere.example.com", self.gotAnswer)
+        self.run_()
+        self.assertEqual(self.results[0][1], libevent.DNS_ERR_NOTEXIST)
+        self.assertEqual(self.results[0], self.results[1])
+        self.assertEqual(len(self.server.queries), 1)
+
+    def testCachedAnswerErrorsGoToErrorPolicy(self):
+        errors = []
+        def boom(hostname, result, addresses):
+            self.eventBase.loopExit(0)
+            raise ValueError("boom")
+        self.eventBase.setErrorHandler(errors.extend, interval=60)
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.resolver.resolve("www.example.com", boom)
+        self.run_()
+        self.eventBase.flushErrors()
+        self.assertEqual([e[1] for e in errors], [ValueError])
+
+    def testZeroTTLIsNotCached(self):
+        self.server.ttl = 0
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.assertEqual(len(self.results), 2)
+        self.assertEqual(len(self.server.queries), 2)
+
+    def testCacheIsBounded(self):
+        self.resolver.maxEntries = 2
+        for name in ("www.example.com", "a.example.com", "b.example.com",
+                     "nowhere.example.com"):
+            self.resolver.resolve(name, self.gotAnswer)
+            self.run_()
+            self.assert_(self.resolver.cacheSize <= 2)
+        self.assertEqual(len(self.results), 4)
+        self.resolver.resolve("nowhere.example.com", self.gotAnswer)
+        self.run_()
+        self.assertEqual(len(self.server.queries), 4)
+
+    def testZeroMaxEntriesDisablesCaching(self):
+        self.resolver.maxEntries = 0
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.assertEqual(self.resolver.cacheSize, 0)
+
+    def testClearCache(self):
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.resolver.clearCache()
+        self.resolver.resolve("www.example.com", self.gotAnswer)
+        self.run_()
+        self.assertEqual(len(self.server.queries), 2)
+
+    def testUninitializedResolver(self):
+        resolver = libevent.Resolver.__new__(libevent.Resolver)
+        self.assertRaises(libevent.EventError, resolver.resolve,
+                          "www.example.com", self.gotAnswer)
+        self.assertRaises(libevent.EventError, resolver.addNameserver,
+                          self.server.address)
+        self.assertRaises(libevent.EventError, resolver.setOption,
+                          "timeout:", "1")
+        self.assertEqual(resolver.cacheSize, 0)
+
+    def testInvalidNonCallableCallback(self):
+        self.assertRaises(libevent.EventError, self.resolver.resolve,
+                          "www.example.com", "not a callable")
+
+if __name__=='__main__':
+    unittest.main()